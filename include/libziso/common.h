@@ -0,0 +1,272 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// The LZ4_ACCELERATION_MAX is defined in the lz4.c file and is about 65537 (now).
+// Testing I have noticed that above 1024 the compression was almost the same, so I'll set the max there.
+constexpr uint16_t LZ4_MAX_ACCELERATION = 1024;
+inline const std::vector<uint16_t> lz4_compression_level = {
+    LZ4_MAX_ACCELERATION,
+    uint16_t(LZ4_MAX_ACCELERATION *((float)10 / 11)),
+    uint16_t(LZ4_MAX_ACCELERATION *((float)9 / 11)),
+    uint16_t(LZ4_MAX_ACCELERATION *((float)8 / 11)),
+    uint16_t(LZ4_MAX_ACCELERATION *((float)7 / 11)),
+    uint16_t(LZ4_MAX_ACCELERATION *((float)6 / 11)),
+    uint16_t(LZ4_MAX_ACCELERATION *((float)5 / 11)),
+    uint16_t(LZ4_MAX_ACCELERATION *((float)4 / 11)),
+    uint16_t(LZ4_MAX_ACCELERATION *((float)3 / 11)),
+    uint16_t(LZ4_MAX_ACCELERATION *((float)2 / 11)),
+    uint16_t(LZ4_MAX_ACCELERATION *((float)1 / 11)),
+    1};
+
+// Max Cache Size
+constexpr uint8_t CACHE_SIZE_MAX = 128;
+constexpr uint8_t CACHE_SIZE_DEFAULT = 4;
+
+// Max duplicates cache size
+constexpr uint16_t DUPLICATES_CACHE_SIZE_MAX = 2048;
+
+// LZ4 ratio band (in percent) where the two-tier compression tries LZ4HC. Below the band LZ4 is already good enough,
+// and above it the blocks are almost incompressible, so LZ4HC gains very little in both sides.
+constexpr uint8_t TWO_TIER_MIN_RATIO = 30;
+constexpr uint8_t TWO_TIER_MAX_RATIO = 90;
+
+// Decode cost model of a slow reader (OPL on the PS2 EE, a 300 MHz MIPS core), used to estimate the load time of
+// the blocks. Every stored byte is read at the read speed, and every compressed block is decompressed at the LZ4
+// speed, so a block is faster to load raw when its saving is below DECODE_MODEL_READ_SPEED / DECODE_MODEL_LZ4_SPEED.
+constexpr uint64_t DECODE_MODEL_READ_SPEED = 4 * 1024 * 1024;
+constexpr uint64_t DECODE_MODEL_LZ4_SPEED = 40 * 1024 * 1024;
+// Cost in microseconds of every device read request (the USB and SMB requests of OPL), which is paid again by a block
+// that crosses an extra sector
+constexpr uint64_t DECODE_MODEL_READ_LATENCY = 200;
+// Max saving (in percent of the block size) required to store a block compressed
+constexpr uint8_t MIN_SAVING_MAX = 99;
+// Min saving which uses the decode cost model to get the saving required by every block
+constexpr uint8_t MIN_SAVING_MODEL = 0xFF;
+
+// Max blocks compressed to estimate the ratio of every compression tier when a target size is set
+constexpr uint32_t TARGET_SAMPLE_BLOCKS = 4096;
+// The ratio of the compressed chunks corrects the estimations between these limits
+constexpr double TARGET_CORRECTION_MIN = 0.5;
+constexpr double TARGET_CORRECTION_MAX = 2.0;
+// Part of the remaining size kept free to absorb the estimation errors of the last chunks
+constexpr double TARGET_SAFETY_MARGIN = 0.01;
+// Weight of the last chunk in the measured ratio of a tier, used when the input is not sampled
+constexpr double TARGET_RATIO_WEIGHT = 0.5;
+
+// The time limits select a tier when its throughput is this times the required one, and try the next unused tier
+// when the current one is this much faster
+constexpr double TIME_HEADROOM = 1.1;
+constexpr double TIME_EXPLORE_HEADROOM = 1.5;
+// Weight of the last chunk in the measured throughput of a tier
+constexpr double TIME_THROUGHPUT_WEIGHT = 0.5;
+
+// Max blocks compressed to estimate the output size, used to select the index shift
+constexpr uint32_t INDEX_SHIFT_SAMPLE_BLOCKS = 1024;
+// Max value of the index positions, which use 31 bits
+constexpr uint64_t INDEX_POSITION_MAX = 0x7FFFFFFF;
+
+// Sector size of the devices read by OPL. A block which crosses more sectors than its size requires costs an extra
+// device read, which the sector layout avoids by padding the previous block up to the next sector. The padding is read
+// at the read speed of the decode cost model, so it pays off when it costs less than the read latency it avoids.
+constexpr uint32_t SECTOR_LAYOUT_SIZE = 2048;
+// Sector layout which uses the decode cost model to get the bytes paid for every avoided read
+constexpr uint16_t SECTOR_LAYOUT_MODEL = 0xFFFF;
+// Bytes read in the time of a device read request, which is the padding paid for every avoided read by the model
+constexpr uint32_t SECTOR_LAYOUT_MODEL_COST = (DECODE_MODEL_READ_LATENCY * DECODE_MODEL_READ_SPEED) / 1000000;
+
+// Max worker threads
+constexpr uint16_t THREADS_MAX = 256;
+
+class iso_file_map;
+
+#pragma pack(push)
+#pragma pack(1)
+struct zheader
+{
+    const char magic[4] = {'Z', 'I', 'S', 'O'}; // Always "ZISO".
+    const uint32_t headerSize = 0x18;           // Always 0x18.
+    uint64_t uncompressedSize = 0;              // Total size of original ISO.
+    uint32_t blockSize = 2048;                  // Size of each block, usually 2048.
+    const uint8_t version = 1;                  // Always 1.
+    uint8_t indexShift = 0;                     // Indicates left shift of index values.
+    const uint8_t unused[2] = {0, 0};           // Always 0.
+};
+#pragma pack(pop)
+
+/**
+ * @brief Options used to compress and decompress the ZSO files
+ *
+ */
+struct ziso_options
+{
+    uint32_t blockSize = 2048;
+    uint32_t cacheSize = CACHE_SIZE_DEFAULT * (1024 * 1024);
+    uint8_t compressionLevel = 12;
+    bool alternativeLz4 = false;
+    bool bruteForce = false;
+    // Try all the LZ4 accelerations and LZ4HC levels in every block
+    bool exhaustive = false;
+    // Compress with LZ4 first, and with LZ4HC only the blocks with an LZ4 ratio between the min and max ratio
+    bool twoTier = false;
+    uint8_t twoTierMinRatio = TWO_TIER_MIN_RATIO;
+    uint8_t twoTierMaxRatio = TWO_TIER_MAX_RATIO;
+    bool lz4hc = false;
+    // Avoid the LZ4HC matches which are slow to decompress, for a small size cost
+    bool favorDecompression = false;
+    bool hdlFix = false;
+    uint16_t threads = 1;
+    // Memory used to store the compressed blocks to detect the repeated ones. 0 to disable it.
+    uint32_t duplicatesCacheSize = 0;
+    // Entropy in bits per byte from which the blocks are stored without compression. 0 to disable it.
+    float entropyThreshold = 0;
+    // Saving in percent of the block size required to store a block compressed. 0 to store compressed every block
+    // which is smaller than the source, or MIN_SAVING_MODEL to require the saving whose read time pays the block
+    // decompression time in the decode cost model.
+    uint8_t minSaving = 0;
+    // Max output size. The encoder selects the fastest compression which fits it in every chunk. 0 to disable it.
+    // The encode methods sample the input before compressing it. The begin, add and finish methods cannot sample it, so
+    // they use the ratio measured in the chunks already compressed by every tier.
+    uint64_t targetSize = 0;
+    // Max compression time in seconds and min throughput in MB/s. The encoder selects the best compression which
+    // keeps the throughput required to finish in time. 0 to disable them. Ignored when the target size is set.
+    // The target size and the time limits select the compression of every chunk, so they replace the compression
+    // level and the alternativeLz4, lz4hc, bruteForce, exhaustive and twoTier options.
+    uint32_t maxTime = 0;
+    float minThroughput = 0;
+    // Padding in bytes paid for every extra device sector read avoided, SECTOR_LAYOUT_MODEL to use the decode cost
+    // model, or 0 to disable the sector layout
+    uint16_t sectorLayout = 0;
+    // Map of the image files used to select the compression of every region. nullptr to use the same options for all.
+    const iso_file_map *fileMap = nullptr;
+};
+
+struct summary
+{
+    uint64_t sourceSize = 0;
+    uint64_t lz4Count = 0;
+    uint64_t lz4In = 0;
+    uint64_t lz4Out = 0;
+    uint64_t lz4m2Count = 0;
+    uint64_t lz4m2In = 0;
+    uint64_t lz4m2Out = 0;
+    uint64_t lz4hcCount = 0;
+    uint64_t lz4hcIn = 0;
+    uint64_t lz4hcOut = 0;
+    uint64_t rawCount = 0;
+    uint64_t raw = 0;
+    // Zero filled blocks, which are also counted in their compression method
+    uint64_t zeroCount = 0;
+    // Blocks searched and found in the duplicates cache
+    uint64_t duplicatesLookups = 0;
+    uint64_t duplicatesHits = 0;
+    // Blocks stored raw by the entropy check, the checked ones and the wrong predictions, and the raw blocks which
+    // were not predicted
+    uint64_t entropySkipped = 0;
+    uint64_t entropyChecked = 0;
+    uint64_t entropyWrong = 0;
+    uint64_t entropyWrongLost = 0;
+    uint64_t entropyMissed = 0;
+    // Blocks stored raw or compressed with LZ4HC because of the file map
+    uint64_t fileMapRaw = 0;
+    uint64_t fileMapHc = 0;
+    // Compressions tried by the exhaustive search, and the ones stopped because they could not win
+    uint64_t exhaustiveAttempts = 0;
+    uint64_t exhaustivePruned = 0;
+    // LZ4HC compressions done and skipped by the two-tier compression, and the bytes lost on the checked blocks. The
+    // nanoseconds spent in the LZ4 and LZ4HC compressions, and in the LZ4HC compression of the checked blocks, are used
+    // to estimate the time saved compared with LZ4HC in every block.
+    uint64_t twoTierHc = 0;
+    uint64_t twoTierSkipped = 0;
+    uint64_t twoTierChecked = 0;
+    uint64_t twoTierCheckedLost = 0;
+    uint64_t twoTierFastTime = 0;
+    uint64_t twoTierHcTime = 0;
+    uint64_t twoTierCheckedTime = 0;
+    // Compressible blocks stored raw because their saving was below the min saving, and the bytes lost
+    uint64_t minSavingRaw = 0;
+    uint64_t minSavingIn = 0;
+    uint64_t minSavingLost = 0;
+    // Blocks checked against the normal LZ4HC when favoring the decompression speed, with the source bytes, and the
+    // compressed bytes and decode nanoseconds of both outputs
+    uint64_t favorChecked = 0;
+    uint64_t favorCheckedIn = 0;
+    uint64_t favorCheckedOut = 0;
+    uint64_t favorCheckedTime = 0;
+    uint64_t normalCheckedOut = 0;
+    uint64_t normalCheckedTime = 0;
+    // Estimated output size when the target size is set
+    uint64_t targetEstimated = 0;
+    // Chunks compressed using every kind of tier when the target size or the time limits are set, and the tier changes
+    uint64_t tierLz4Chunks = 0;
+    uint64_t tierTwoTierChunks = 0;
+    uint64_t tierHcChunks = 0;
+    uint64_t tierChanges = 0;
+    // Index shift used in the output, the shift which fits any output of the same input, and the times that the
+    // output was compressed again because it didn't fit the selected shift
+    uint64_t indexShift = 0;
+    uint64_t indexShiftWorstCase = 0;
+    uint64_t layoutRestarts = 0;
+    // Blocks which were moved to the next sector to avoid an extra sector read, the padding used, and the blocks which
+    // still cross an extra sector because the padding didn't pay off or didn't fit
+    uint64_t sectorStraddlesAvoided = 0;
+    uint64_t sectorPadding = 0;
+    uint64_t sectorStraddles = 0;
+
+    summary &operator+=(const summary &other)
+    {
+        sourceSize += other.sourceSize;
+        lz4Count += other.lz4Count;
+        lz4In += other.lz4In;
+        lz4Out += other.lz4Out;
+        lz4m2Count += other.lz4m2Count;
+        lz4m2In += other.lz4m2In;
+        lz4m2Out += other.lz4m2Out;
+        lz4hcCount += other.lz4hcCount;
+        lz4hcIn += other.lz4hcIn;
+        lz4hcOut += other.lz4hcOut;
+        rawCount += other.rawCount;
+        raw += other.raw;
+        zeroCount += other.zeroCount;
+        duplicatesLookups += other.duplicatesLookups;
+        duplicatesHits += other.duplicatesHits;
+        entropySkipped += other.entropySkipped;
+        entropyChecked += other.entropyChecked;
+        entropyWrong += other.entropyWrong;
+        entropyWrongLost += other.entropyWrongLost;
+        entropyMissed += other.entropyMissed;
+        fileMapRaw += other.fileMapRaw;
+        fileMapHc += other.fileMapHc;
+        exhaustiveAttempts += other.exhaustiveAttempts;
+        exhaustivePruned += other.exhaustivePruned;
+        twoTierHc += other.twoTierHc;
+        twoTierSkipped += other.twoTierSkipped;
+        twoTierChecked += other.twoTierChecked;
+        twoTierCheckedLost += other.twoTierCheckedLost;
+        twoTierFastTime += other.twoTierFastTime;
+        twoTierHcTime += other.twoTierHcTime;
+        twoTierCheckedTime += other.twoTierCheckedTime;
+        minSavingRaw += other.minSavingRaw;
+        minSavingIn += other.minSavingIn;
+        minSavingLost += other.minSavingLost;
+        favorChecked += other.favorChecked;
+        favorCheckedIn += other.favorCheckedIn;
+        favorCheckedOut += other.favorCheckedOut;
+        favorCheckedTime += other.favorCheckedTime;
+        normalCheckedOut += other.normalCheckedOut;
+        normalCheckedTime += other.normalCheckedTime;
+        targetEstimated += other.targetEstimated;
+        tierLz4Chunks += other.tierLz4Chunks;
+        tierTwoTierChunks += other.tierTwoTierChunks;
+        tierHcChunks += other.tierHcChunks;
+        tierChanges += other.tierChanges;
+        indexShift += other.indexShift;
+        indexShiftWorstCase += other.indexShiftWorstCase;
+        layoutRestarts += other.layoutRestarts;
+        sectorStraddlesAvoided += other.sectorStraddlesAvoided;
+        sectorPadding += other.sectorPadding;
+        sectorStraddles += other.sectorStraddles;
+        return *this;
+    }
+};
@@ -0,0 +1,256 @@
+#pragma once
+
+#include "common.h"
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#define LZ4_STATIC_LINKING_ONLY
+#define LZ4_HC_STATIC_LINKING_ONLY
+#include "lz4.h"
+#include "lz4hc.h"
+
+// One of every ENTROPY_CHECK_INTERVAL blocks skipped by the entropy check is compressed to measure the accuracy
+constexpr uint32_t ENTROPY_CHECK_INTERVAL = 16;
+
+// One of every TWO_TIER_CHECK_INTERVAL blocks skipped by the two-tier compression is compressed using LZ4HC to
+// measure the lost bytes
+constexpr uint32_t TWO_TIER_CHECK_INTERVAL = 16;
+
+// One of every FAVOR_CHECK_INTERVAL blocks compressed favoring the decompression speed is also compressed using the
+// normal LZ4HC, and both outputs are decompressed to measure the decode speed
+constexpr uint32_t FAVOR_CHECK_INTERVAL = 16;
+// Decompressions of every checked output, keeping the fastest one to reduce the timing noise
+constexpr uint32_t FAVOR_CHECK_DECODES = 4;
+
+// Methods which can be selected by the exhaustive search
+constexpr uint8_t EXHAUSTIVE_LZ4 = 0;
+constexpr uint8_t EXHAUSTIVE_LZ4_MODE2 = 1;
+constexpr uint8_t EXHAUSTIVE_LZ4HC = 2;
+
+/**
+ * @brief Cache of compressed blocks shared by all the compression threads. The blocks are stored by the hash of their
+ * data, so a repeated block is copied from the cache instead of compressing it again. The data of the block is also
+ * stored and compared, so a hash collision will never produce a wrong output.
+ *
+ * The cache is splitted into shards with their own lock. When a shard reaches its memory limit, the oldest blocks
+ * are removed first.
+ */
+class duplicates_cache
+{
+public:
+    /**
+     * @brief Construct a new duplicates cache
+     *
+     * @param maxSize The memory used by the cache, including the data and the compressed data of the blocks
+     */
+    duplicates_cache(uint64_t maxSize);
+
+    /**
+     * @brief Search a block in the cache and copy its compressed data
+     *
+     * @param hash The block data hash
+     * @param src The block data
+     * @param srcSize The block data size
+     * @param dst The destination buffer to store the compressed data
+     * @param dstSize The space in the destination buffer
+     * @param uncompressed (output) True if the block is stored without compression
+     * @param blockSummary (output) The summary data of the block compression
+     * @return uint32_t The compressed data size. Will return 0 if the block is not in the cache.
+     */
+    uint32_t find(uint64_t hash, const char *src, uint32_t srcSize, char *dst, uint32_t dstSize, bool &uncompressed, summary &blockSummary);
+
+    /**
+     * @brief Add a compressed block to the cache. If there is already a block with the same hash, nothing is done.
+     *
+     * @param hash The block data hash
+     * @param src The block data
+     * @param srcSize The block data size
+     * @param compressed The compressed data
+     * @param compressedSize The compressed data size
+     * @param uncompressed True if the block is stored without compression
+     * @param blockSummary The summary data of the block compression
+     */
+    void insert(uint64_t hash, const char *src, uint32_t srcSize, const char *compressed, uint32_t compressedSize, bool uncompressed, const summary &blockSummary);
+
+private:
+    struct cache_entry
+    {
+        std::vector<char> data;
+        std::vector<char> compressedData;
+        bool uncompressed;
+        summary blockSummary;
+    };
+
+    struct cache_shard
+    {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, cache_entry> entries;
+        // Insertion order, used to remove the oldest entries
+        std::deque<uint64_t> order;
+        uint64_t size = 0;
+    };
+
+    static constexpr uint16_t SHARDS = 16;
+
+    uint64_t shardMaxSize;
+    std::unique_ptr<cache_shard[]> shards;
+};
+
+/**
+ * @brief The options which change the compressed data of a block. The blocks compressed using a different key
+ * are never copied between them, because the file map and the compression tiers change the options of some blocks.
+ */
+struct compression_key
+{
+    compression_key(const ziso_options &options);
+    bool operator==(const compression_key &other) const = default;
+
+    /**
+     * @brief Get a hash of the key, used as the seed of the duplicates cache hashes
+     *
+     * @return uint64_t The key hash
+     */
+    uint64_t hash() const;
+
+    uint8_t compressionLevel;
+    bool alternativeLz4;
+    bool lz4hc;
+    bool bruteForce;
+    bool exhaustive;
+    bool twoTier;
+    uint8_t twoTierMinRatio;
+    uint8_t twoTierMaxRatio;
+    bool favorDecompression;
+    uint8_t minSaving;
+    float entropyThreshold;
+};
+
+/**
+ * @brief Compression state reused between the blocks compressed by a thread.
+ *
+ * It keeps the LZ4 states and the brute-force scratch buffers preallocated, so the blocks are compressed without
+ * allocating memory. The LZ4HC and the LZ4 Mode 2 states are reset using the fast reset functions, which avoid
+ * to clear the full state (about 256KB in the LZ4HC case). The standard LZ4 state is still fully reset because
+ * its output depends on the clean hash table, and it must be the same as the ziso.py output.
+ */
+struct compression_context
+{
+    compression_context(const ziso_options &options);
+
+    LZ4_stream_t lz4State;
+    LZ4_stream_t lz4Method2State;
+    LZ4_streamHC_t lz4hcState;
+
+    // Brute-force and exhaustive search compression buffers
+    std::vector<char> lz4Buffer;
+    std::vector<char> lz4Method2Buffer;
+
+    // A zero filled block compressed with the current options, which is copied instead of compressing the zero
+    // blocks again. The summary data of the block is added to the thread summary on every copy.
+    std::vector<char> zeroBlock;
+    bool zeroBlockUncompressed = false;
+    summary zeroBlockSummary;
+    // The options used to compress the zero block. The blocks compressed with other options are not copied.
+    compression_key zeroBlockKey;
+
+    // Cache of the already compressed blocks, shared by all the threads. nullptr if disabled.
+    duplicates_cache *duplicates = nullptr;
+
+    // The count * log2(count) values used to calculate the blocks entropy
+    std::vector<float> entropyTable;
+    // Blocks skipped by the entropy check, and buffer to compress the checked ones
+    uint64_t entropySkippedBlocks = 0;
+    std::vector<char> entropyCheckBuffer;
+    // Blocks which were not compressed using LZ4HC by the two-tier compression
+    uint64_t twoTierSkippedBlocks = 0;
+    // Blocks compressed favoring the decompression speed, and buffer to decompress the checked ones
+    uint64_t favorBlocks = 0;
+    std::vector<char> favorDecodeBuffer;
+};
+
+/**
+ * @brief Check if a block is filled with zeroes. The data is checked in stripes of 64 bytes which are merged using
+ * OR operations, so the compiler can vectorize them, and the check ends in the first stripe with data.
+ *
+ * @param src The block data
+ * @param srcSize The block size
+ * @return true If all the bytes are zero
+ * @return false If any byte is not zero
+ */
+bool is_zero_block(const char *src, uint32_t srcSize);
+
+/**
+ * @brief Compress a block. The zero filled blocks are not compressed, but copied from the compression context.
+ * The repeated blocks are also copied from the duplicates cache, if the context has one. If the entropy threshold
+ * is set, the blocks with a higher entropy are stored without trying to compress them.
+ *
+ * @param src The source data to "compress" (or not)
+ * @param srcSize The source data size
+ * @param dst The destination buffer to store the data. It must have enough space or will fail
+ * @param dstSize The space in the destination buffer
+ * @param uncompressed (output) True if the data was not compressed or false otherwise.
+ * @param options Compression options
+ * @param context The compression states and buffers of the current thread
+ * @param summaryData The summary data of the current thread
+ * @return uint32_t The compressed data size. Will return 0 if something was wrong.
+ */
+uint32_t compress_block(
+    const char *src,
+    uint32_t srcSize,
+    char *dst,
+    uint32_t dstSize,
+    bool &uncompressed,
+    const ziso_options &options,
+    compression_context &context,
+    summary &summaryData);
+
+/**
+ * @brief Store a block without compression
+ *
+ * @param src The source data
+ * @param srcSize The source data size
+ * @param dst The destination buffer to store the data
+ * @param dstSize The space in the destination buffer
+ * @param uncompressed (output) Always true
+ * @param summaryData The summary data of the current thread
+ * @return uint32_t The stored data size. Will return 0 if the data doesn't fit the destination buffer.
+ */
+uint32_t store_block(
+    const char *src,
+    uint32_t srcSize,
+    char *dst,
+    uint32_t dstSize,
+    bool &uncompressed,
+    summary &summaryData);
+
+/**
+ * @brief Decompress a block
+ *
+ * @param src The compressed block data
+ * @param srcSize The compressed block size
+ * @param dst The destination buffer to store the decompressed data
+ * @param dstSize The expected decompressed size
+ * @param uncompressed True if the block was stored without compression
+ * @return uint32_t The decompressed data size. Will return 0 if something was wrong.
+ */
+uint32_t decompress_block(
+    const char *src,
+    uint32_t srcSize,
+    char *dst,
+    uint32_t dstSize,
+    bool uncompressed);
+
+/**
+ * @brief Fill the buffer with zeroes until the position is aligned to the index shift
+ *
+ * @param buffer The buffer to fill
+ * @param currentPosition The output position of the buffer start
+ * @param shift The index shift
+ * @return uint16_t The number of padding bytes added
+ */
+uint16_t buffer_align(
+    char *buffer,
+    uint64_t currentPosition,
+    uint8_t shift);
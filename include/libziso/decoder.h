@@ -0,0 +1,75 @@
+#pragma once
+
+#include "common.h"
+#include "io.h"
+#include <functional>
+
+/**
+ * @brief ZSO decoder. Reads the header and the blocks index of a ZSO file and decompress it into an output.
+ *
+ */
+class ziso_decoder
+{
+public:
+    typedef std::function<void(uint64_t currentInput, uint64_t totalInput)> progress_callback;
+
+    /**
+     * @brief Construct a new decoder
+     *
+     * @param threads Number of threads used to decompress the blocks
+     * @param cacheSize The memory used to read and decompress the blocks
+     */
+    ziso_decoder(uint16_t threads = 1, uint32_t cacheSize = CACHE_SIZE_DEFAULT * (1024 * 1024));
+
+    /**
+     * @brief Set a function which will be called after every decompressed range of blocks
+     *
+     * @param callback The function which will receive the processed input bytes and the total input size
+     */
+    void set_progress_callback(progress_callback callback);
+
+    /**
+     * @brief Reads the header and the blocks index of the input
+     *
+     * @param newInput The ZSO input. Must be valid while the decoder is in use.
+     * @param ignoreHeaderSize Don't check if the input size matches the size stored in the blocks index
+     * @return true If the input is a valid ZSO file
+     * @return false If the input is not a ZSO file or is damaged
+     */
+    bool open(ziso_input &newInput, bool ignoreHeaderSize = false);
+
+    /**
+     * @brief Decompress the input into the output. When several threads are used, every thread decompress a
+     * range of blocks and writes it directly at its final position in the output.
+     *
+     * @param output The output where the decompressed data will be written
+     * @return true If the data was decompressed
+     * @return false If there was an error
+     */
+    bool decode(ziso_output &output);
+
+    /**
+     * @brief Decompress a ZSO file stored in memory
+     *
+     * @param src The ZSO file data
+     * @param srcSize The ZSO file size
+     * @param dst (output) The decompressed data
+     * @param threads Number of threads used to decompress the blocks
+     * @return true If the data was decompressed
+     * @return false If there was an error
+     */
+    static bool decode(const char *src, uint64_t srcSize, std::vector<char> &dst, uint16_t threads = 1);
+
+    const zheader &get_header() const;
+    const std::vector<uint32_t> &get_blocks() const;
+
+private:
+    uint16_t threads;
+    uint32_t cacheSize;
+    progress_callback progress = nullptr;
+
+    ziso_input *input = nullptr;
+    uint64_t inputSize = 0;
+    zheader fileHeader;
+    std::vector<uint32_t> blocks;
+};
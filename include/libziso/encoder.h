@@ -0,0 +1,196 @@
+#pragma once
+
+#include "common.h"
+#include "io.h"
+#include <chrono>
+#include <functional>
+#include <memory>
+
+class compression_pool;
+class io_thread;
+
+/**
+ * @brief ZSO encoder. Compress the input data into blocks and writes the header, the blocks index and the
+ * compressed blocks into the output.
+ *
+ * The data can be provided at once from a ziso_input using the encode method, or in buffers of any size using
+ * the begin, add and finish methods.
+ */
+class ziso_encoder
+{
+public:
+    typedef std::function<void(uint64_t currentInput, uint64_t currentOutput)> progress_callback;
+
+    ziso_encoder(const ziso_options &options);
+    ~ziso_encoder();
+
+    /**
+     * @brief Set a function which will be called after every compressed block
+     *
+     * @param callback The function which will receive the processed input bytes and the compressed data bytes
+     */
+    void set_progress_callback(progress_callback callback);
+
+    /**
+     * @brief Starts a new ZSO file. Writes the header and reserves the blocks index space.
+     *
+     * @param newOutput The output where the ZSO file will be written. Must be valid until finish is called.
+     * @param uncompressedSize The total size of the data which will be compressed
+     * @return true If the header was written
+     * @return false If there was an error
+     */
+    bool begin(ziso_output &newOutput, uint64_t uncompressedSize);
+
+    /**
+     * @brief Compress data. Can be called several times with any data size until all the data is added.
+     *
+     * @param src The data to compress
+     * @param srcSize The data size
+     * @return true If the data was compressed
+     * @return false If there was an error
+     */
+    bool add(const char *src, uint64_t srcSize);
+
+    /**
+     * @brief Compress the pending data, align the output and writes the blocks index.
+     *
+     * @return true If the file was finished
+     * @return false If there was an error or the added data size doesn't matches the uncompressed size
+     */
+    bool finish();
+
+    /**
+     * @brief Compress the full input into the output. The input is read by a dedicated thread, so the next
+     * chunk is read while the current one is compressed.
+     *
+     * The index shift is selected using the estimated output size instead of the worst case, so the images which
+     * compress below the limit of a smaller shift don't waste the alignment padding. If the output doesn't fit the
+     * selected shift, it is compressed again using the next shift, and the output is truncated to the size of the
+     * last pass.
+     *
+     * @param input The input data
+     * @param output The output where the ZSO file will be written
+     * @return true If the file was compressed
+     * @return false If there was an error
+     */
+    bool encode(ziso_input &input, ziso_output &output);
+
+    /**
+     * @brief Compress a memory buffer into a ZSO file in memory
+     *
+     * @param options Compression options
+     * @param src The data to compress
+     * @param srcSize The data size
+     * @param dst (output) The ZSO file data
+     * @return true If the data was compressed
+     * @return false If there was an error
+     */
+    static bool encode(const ziso_options &options, const char *src, uint64_t srcSize, std::vector<char> &dst);
+
+    /**
+     * @brief Get the blocks index shift required to store the positions of any compressed output of a file, which
+     * is the smallest shift that fits the uncompressed data with the alignment and sector layout padding of every block
+     *
+     * @param uncompressedSize The uncompressed data size
+     * @param blockSize The block size
+     * @param sectorLayout The sector layout option. 0 if disabled.
+     * @return uint8_t The index shift
+     */
+    static uint8_t get_index_shift(uint64_t uncompressedSize, uint32_t blockSize, uint16_t sectorLayout = 0);
+
+    const zheader &get_header() const;
+    const std::vector<uint32_t> &get_blocks() const;
+    uint64_t get_output_size() const;
+
+    /**
+     * @brief Get the summary data of all the compression threads
+     *
+     * @return summary The compression summary
+     */
+    summary get_summary();
+
+private:
+    bool compress_input(ziso_input &input, uint64_t inputSize);
+    double estimate_sector_padding(uint32_t compressedSize) const;
+    uint8_t estimate_index_shift(ziso_input &input, uint64_t inputSize);
+    void build_tiers();
+    void apply_tier(size_t tier);
+    bool plan_target_size(ziso_input &input, uint64_t inputSize);
+    void select_target_tier(uint32_t srcSize);
+    void select_written_tier(uint32_t srcSize);
+    double estimate_target_size(size_t tier, uint64_t start, uint64_t end) const;
+    void select_time_tier(uint32_t srcSize);
+    bool compress_chunk(const char *src, uint32_t srcSize);
+    static uint32_t get_sector_read_cost(uint16_t sectorLayout);
+    static uint32_t get_sector_padding_max(uint16_t sectorLayout);
+    uint32_t sector_padding(char *buffer, uint64_t position, uint32_t size, uint32_t nextSize);
+    bool flush_write_buffer();
+    bool write_padding(uint8_t shift);
+
+    ziso_options options;
+    zheader fileHeader;
+    std::vector<uint32_t> blocks;
+    uint32_t blocksNumber = 0;
+    uint32_t headerSize = 0;
+    progress_callback progress = nullptr;
+
+    ziso_output *output = nullptr;
+    // Index shift used by the begin method. INDEX_SHIFT_WORST_CASE to use the shift which fits any output.
+    static constexpr uint8_t INDEX_SHIFT_WORST_CASE = 0xFF;
+    uint8_t layoutShift = INDEX_SHIFT_WORST_CASE;
+    // The output passed the max position of the index shift, so it must be compressed again
+    bool layoutOverflow = false;
+    uint64_t layoutRestarts = 0;
+    uint64_t inputPosition = 0;
+    uint64_t outputPosition = 0;
+    uint32_t currentBlock = 0;
+    // Start of the previous block, which grows with the sector layout padding
+    uint64_t lastBlockPosition = 0;
+    summary layoutSummary;
+
+    // The data is compressed in chunks of a multiple of the block size
+    uint32_t chunkSize = 0;
+    std::vector<char> pendingBuffer;
+    uint32_t pendingSize = 0;
+
+    // Slots to store the compressed blocks before writting them in order
+    std::vector<char> slotsBuffer;
+
+    // The write buffers are written by the writer thread while the other one is being filled
+    std::vector<char> writeBuffers[2];
+    uint8_t currentWriteBuffer = 0;
+    uint32_t writeBufferPos = 0;
+    bool writeFailed = false;
+
+    // Compression tiers sorted by cost, used by the target size and the time limits. Every tier has the accumulated
+    // output size of the sampled blocks, and the measured throughput in bytes per second and ratio of the compressed
+    // chunks (0 if it was not used).
+    struct compression_tier
+    {
+        ziso_options options;
+        std::vector<uint64_t> sampledSizes;
+        double throughput;
+        double ratio;
+    };
+    std::vector<compression_tier> tiers;
+    size_t currentTier = 0;
+    summary tierSummary;
+    // Accumulated input size of the sampled blocks, which are one of every targetSampleStep blocks. Empty if the
+    // input was not sampled, so the tiers are selected using the ratio of the compressed chunks.
+    std::vector<uint64_t> targetSampledInput;
+    uint64_t targetSampleStep = 1;
+    // Output size available for the blocks, and the output size predicted for the compressed chunks
+    uint64_t targetDataSize = 0;
+    double targetPredicted = 0;
+    // Start of the compression and of the current chunk, used by the time limits. The encode methods set the start
+    // once for all the passes.
+    bool encoding = false;
+    std::chrono::steady_clock::time_point timeStart;
+    std::chrono::steady_clock::time_point chunkStart;
+    uint32_t chunkInput = 0;
+    // Output position at the start of the current chunk, used by the target size without sampling
+    uint64_t chunkOutput = 0;
+
+    std::unique_ptr<compression_pool> compressor;
+    std::unique_ptr<io_thread> writer;
+};
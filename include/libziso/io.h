@@ -0,0 +1,477 @@
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Alignment of the positions, sizes and buffers used with the direct I/O
+constexpr uint32_t DIRECT_IO_ALIGNMENT = 4096;
+
+// Requests sent at the same time to the kernel by the io_uring backend by default
+constexpr uint32_t URING_QUEUE_DEPTH_DEFAULT = 32;
+// Max size of every io_uring request. The bigger reads and writes are splitted into several requests.
+constexpr uint32_t URING_SEGMENT_SIZE = 0x40000;
+
+/**
+ * @brief Input data used by the encoder and the decoder. The data is read by position, so several threads
+ * can read from it at the same time.
+ *
+ */
+class ziso_input
+{
+public:
+    virtual ~ziso_input() = default;
+
+    /**
+     * @brief Get the input data size
+     *
+     * @return uint64_t The input size in bytes
+     */
+    virtual uint64_t size() = 0;
+
+    /**
+     * @brief Read data from the input
+     *
+     * @param position The position of the data to read
+     * @param dst The destination buffer
+     * @param size The size of the data to read
+     * @return true If all the data was read
+     * @return false If there was an error or the data is beyond the end of the input
+     */
+    virtual bool read(uint64_t position, char *dst, uint64_t size) = 0;
+
+    /**
+     * @brief Get a pointer to the input data if it's stored in memory, so it can be used without copying it
+     *
+     * @param position The position of the data
+     * @param size The size of the data
+     * @return const char* The data, or nullptr if the input is not in memory or the data is beyond the end of the input
+     */
+    virtual const char *get_data(uint64_t position, uint64_t size)
+    {
+        (void)position;
+        (void)size;
+        return nullptr;
+    }
+    /**
+     * @brief Inform that a buffer will be used to read data, so the input can prepare it to speed up the reads.
+     * The buffer must not be released or resized until it's unregistered, and no reads must be in progress.
+     *
+     * @param buffer The buffer
+     * @param size The buffer size
+     */
+    virtual void register_buffer(char *buffer, uint64_t size)
+    {
+        (void)buffer;
+        (void)size;
+    }
+
+    /**
+     * @brief Inform that a registered buffer will not be used anymore. No reads must be in progress.
+     *
+     * @param buffer The buffer
+     */
+    virtual void unregister_buffer(char *buffer)
+    {
+        (void)buffer;
+    }
+};
+
+/**
+ * @brief Output used by the encoder and the decoder. The data is written by position, so several threads
+ * can write to it at the same time.
+ *
+ */
+class ziso_output
+{
+public:
+    virtual ~ziso_output() = default;
+
+    /**
+     * @brief Write data into the output
+     *
+     * @param position The position where the data will be written
+     * @param src The data to write
+     * @param size The size of the data
+     * @return true If all the data was written
+     * @return false If there was an error writting the data
+     */
+    virtual bool write(uint64_t position, const char *src, uint64_t size) = 0;
+
+    /**
+     * @brief Remove the data after a position of the output. No writes must be in progress.
+     *
+     * @param size The new output size
+     * @return true If the output was truncated
+     * @return false If there was an error or the output cannot be truncated
+     */
+    virtual bool truncate(uint64_t size)
+    {
+        (void)size;
+        return false;
+    }
+
+    /**
+     * @brief Inform that a buffer will be used to write data, so the input can prepare it to speed up the writes.
+     * The buffer must not be released or resized until it's unregistered, and no writes must be in progress.
+     *
+     * @param buffer The buffer
+     * @param size The buffer size
+     */
+    virtual void register_buffer(char *buffer, uint64_t size)
+    {
+        (void)buffer;
+        (void)size;
+    }
+
+    /**
+     * @brief Inform that a registered buffer will not be used anymore. No reads must be in progress.
+     *
+     * @param buffer The buffer
+     */
+    virtual void unregister_buffer(char *buffer)
+    {
+        (void)buffer;
+    }
+};
+
+/**
+ * @brief Input data stored in memory. The memory must be valid while the input is in use.
+ *
+ */
+class memory_input : public ziso_input
+{
+public:
+    memory_input(const char *data, uint64_t dataSize);
+
+    uint64_t size() override;
+    bool read(uint64_t position, char *dst, uint64_t size) override;
+    const char *get_data(uint64_t position, uint64_t size) override;
+
+private:
+    const char *data;
+    uint64_t dataSize;
+};
+
+/**
+ * @brief Input from a file mapped into memory. The data is read directly from the page cache, without copying
+ * it into intermediate buffers. The kernel is advised that the file will be read sequentially, so it will read
+ * ahead the next pages.
+ *
+ */
+class mmap_input : public ziso_input
+{
+public:
+    ~mmap_input();
+
+    /**
+     * @brief Map a file into memory
+     *
+     * @param filename The file to map
+     * @return true If the file was mapped
+     * @return false If the file cannot be opened or mapped. Not supported on Windows.
+     */
+    bool open(const std::string &filename);
+
+    uint64_t size() override;
+    bool read(uint64_t position, char *dst, uint64_t size) override;
+    const char *get_data(uint64_t position, uint64_t size) override;
+
+private:
+    void close();
+
+    char *data = nullptr;
+    uint64_t dataSize = 0;
+};
+
+/**
+ * @brief Output stored in memory. The buffer grows to fit the written data.
+ *
+ */
+class memory_output : public ziso_output
+{
+public:
+    bool write(uint64_t position, const char *src, uint64_t size) override;
+    bool truncate(uint64_t size) override;
+
+    /**
+     * @brief Get the output data
+     *
+     * @return std::vector<char>& The written data
+     */
+    std::vector<char> &get_data();
+
+private:
+    std::mutex mutex;
+    std::vector<char> data;
+};
+
+/**
+ * @brief Input from a file descriptor. The file descriptor must be opened in read mode and is not closed.
+ *
+ */
+class fd_input : public ziso_input
+{
+public:
+    fd_input(int fd);
+
+    uint64_t size() override;
+    bool read(uint64_t position, char *dst, uint64_t size) override;
+
+    /**
+     * @brief Advise the system that the file will be read sequentially, and remove the data from the system cache
+     * once it is read. Reading a big file will not fill the memory with data which will not be used again.
+     * It has no effect on non Linux systems.
+     *
+     * @param dropCache true to enable it
+     */
+    void set_drop_cache(bool dropCache);
+
+protected:
+    int fd;
+    bool dropCache = false;
+#if defined(_WIN32)
+    // There is no positional read, so the seek and the read must be atomic
+    std::mutex mutex;
+#endif
+};
+
+/**
+ * @brief Output to a file descriptor. The file descriptor must be opened in write mode and is not closed.
+ *
+ */
+class fd_output : public ziso_output
+{
+public:
+    fd_output(int fd);
+
+    bool write(uint64_t position, const char *src, uint64_t size) override;
+    bool truncate(uint64_t size) override;
+
+    /**
+     * @brief Send the written data to the drive every time the written size reaches the writeback size, instead of
+     * waiting for the system to do it. Before starting a new writeback, the previous one is waited and its data is
+     * removed from the system cache, so the memory waiting to be written is limited to about three times the
+     * writeback size. It has no effect on non Linux systems.
+     *
+     * @param writebackSize The size which starts a writeback. 0 to disable it.
+     */
+    void set_writeback(uint64_t writebackSize);
+
+protected:
+    int fd;
+#if defined(_WIN32)
+    // There is no positional write, so the seek and the write must be atomic
+    std::mutex mutex;
+#endif
+
+private:
+    struct written_range
+    {
+        uint64_t position;
+        uint64_t size;
+    };
+
+    void writeback(uint64_t position, uint64_t size);
+
+    uint64_t writebackSize = 0;
+    // Written data not sent to the drive yet
+    std::vector<written_range> pendingRanges;
+    uint64_t pendingSize = 0;
+    // Data which is being written by the drive
+    std::vector<written_range> flushingRanges;
+    std::mutex writebackMutex;
+};
+
+/**
+ * @brief Input from a file. The file is opened and closed by the input, and is read using positional reads.
+ *
+ */
+class file_input : public fd_input
+{
+public:
+    file_input();
+    ~file_input();
+
+    /**
+     * @brief Open a file to read it
+     *
+     * @param filename The file to open
+     * @return true If the file was opened
+     * @return false If the file cannot be opened
+     */
+    bool open(const std::string &filename);
+    void close();
+};
+
+/**
+ * @brief Output to a file. The file is opened and closed by the output, and is written using positional writes.
+ *
+ */
+class file_output : public fd_output
+{
+public:
+    file_output();
+    ~file_output();
+
+    /**
+     * @brief Open a file to write it. If the file exists, its content is removed.
+     *
+     * @param filename The file to open
+     * @return true If the file was opened
+     * @return false If the file cannot be opened
+     */
+    bool open(const std::string &filename);
+    void close();
+};
+
+/**
+ * @brief Input from a file opened with direct I/O (O_DIRECT), which bypasses the system cache. The direct I/O
+ * requires aligned positions, sizes and buffers, so the data is read into an aligned buffer and then copied.
+ *
+ */
+class direct_file_input : public ziso_input
+{
+public:
+    /**
+     * @brief Construct a new direct file input
+     *
+     * @param bufferSize The size of the aligned buffer. Bigger reads will be splitted.
+     */
+    direct_file_input(uint32_t bufferSize);
+    ~direct_file_input();
+
+    /**
+     * @brief Open a file to read it
+     *
+     * @param filename The file to open
+     * @return true If the file was opened
+     * @return false If the file cannot be opened or the system doesn't support direct I/O
+     */
+    bool open(const std::string &filename);
+    void close();
+
+    uint64_t size() override;
+    bool read(uint64_t position, char *dst, uint64_t size) override;
+
+private:
+    int fd = -1;
+    uint32_t bufferSize;
+    char *buffer = nullptr;
+    // The aligned buffer is shared by all the threads
+    std::mutex mutex;
+};
+
+/**
+ * @brief Output to a file opened with direct I/O (O_DIRECT), which bypasses the system cache. The data is copied
+ * into an aligned buffer before writing it. If a write doesn't start or end in an aligned position, the sectors
+ * at the edges are read and merged with the new data. The file is truncated to its real size when closed.
+ *
+ */
+class direct_file_output : public ziso_output
+{
+public:
+    /**
+     * @brief Construct a new direct file output
+     *
+     * @param bufferSize The size of the aligned buffer. Bigger writes will be splitted.
+     */
+    direct_file_output(uint32_t bufferSize);
+    ~direct_file_output();
+
+    /**
+     * @brief Open a file to write it. If the file exists, its content is removed.
+     *
+     * @param filename The file to open
+     * @return true If the file was opened
+     * @return false If the file cannot be opened or the system doesn't support direct I/O
+     */
+    bool open(const std::string &filename);
+
+    /**
+     * @brief Close the file, adjusting its size to the written data
+     *
+     * @return true If the file was closed
+     * @return false If the file size cannot be adjusted
+     */
+    bool close();
+
+    bool write(uint64_t position, const char *src, uint64_t size) override;
+    bool truncate(uint64_t size) override;
+
+private:
+    bool read_sector(uint64_t position, char *dst);
+
+    int fd = -1;
+    uint32_t bufferSize;
+    char *buffer = nullptr;
+    // The size of the written data. The file can be bigger because the writes are aligned.
+    uint64_t dataSize = 0;
+    uint64_t fileSize = 0;
+    // The edge sectors are read and written, so the writes cannot be done at the same time
+    std::mutex mutex;
+};
+
+/**
+ * @brief File input and output using the Linux io_uring interface. Every read and write is splitted into several
+ * requests which are sent to the kernel at once, so the drive receives several requests at the same time instead
+ * of one by one. The queue is shared by all the threads, so the requests of concurrent reads and writes are also
+ * in flight at the same time. The registered buffers are also registered into the kernel, which avoids to map their
+ * pages on every request.
+ *
+ * The open method will fail if io_uring is not available (non Linux systems, old kernels or disabled by the
+ * system), so the standard file input and output can be used instead.
+ */
+class uring_file : public ziso_input, public ziso_output
+{
+public:
+    uring_file(uint32_t queueDepth = URING_QUEUE_DEPTH_DEFAULT);
+    ~uring_file();
+
+    /**
+     * @brief Open a file and initializes the io_uring queue
+     *
+     * @param filename The file to open
+     * @param writeMode Open the file to write instead of reading it. The file must exists.
+     * @return true If the file was opened
+     * @return false If the file cannot be opened or io_uring is not available
+     */
+    bool open(const std::string &filename, bool writeMode);
+
+    uint64_t size() override;
+    bool read(uint64_t position, char *dst, uint64_t size) override;
+    bool write(uint64_t position, const char *src, uint64_t size) override;
+    bool truncate(uint64_t size) override;
+    void register_buffer(char *buffer, uint64_t size) override;
+    void unregister_buffer(char *buffer) override;
+
+private:
+    struct uring_queue;
+    struct uring_transfer;
+
+    bool transfer(bool writeMode, uint64_t position, char *buffer, uint64_t size);
+    void submit_requests(uring_transfer &current, bool writeMode);
+    void reap_completions();
+    int get_buffer_index(const char *buffer, uint32_t size) const;
+    void update_registered_buffers();
+    void close();
+
+    uint32_t queueDepth;
+    int fd = -1;
+    std::unique_ptr<uring_queue> queue;
+    // The queue is updated under the mutex, and only one thread waits for the completions of all the transfers
+    std::mutex mutex;
+    std::condition_variable completed;
+    uint32_t inFlight = 0;
+    uint32_t unsubmitted = 0;
+    bool reaping = false;
+    // The queue failed and the state of the requests is unknown, so every transfer will fail
+    bool broken = false;
+    // The buffers cannot be registered again while there are requests in flight
+    uint32_t registering = 0;
+    std::vector<std::pair<char *, uint64_t>> buffers;
+    bool buffersRegistered = false;
+};
\ No newline at end of file
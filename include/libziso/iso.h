@@ -0,0 +1,85 @@
+#pragma once
+
+#include "common.h"
+#include "io.h"
+#include <string>
+#include <vector>
+
+// Sector size of the ISO9660 filesystem
+constexpr uint32_t ISO_SECTOR_SIZE = 2048;
+// Max directories read from the filesystem, to avoid loops in corrupted images
+constexpr uint32_t ISO_MAX_DIRECTORIES = 65536;
+// Max size of a directory extent
+constexpr uint32_t ISO_MAX_DIRECTORY_SIZE = 16 * 1024 * 1024;
+// LZ4HC level used for the executables and archives
+constexpr uint8_t ISO_HC_LEVEL = 12;
+
+// Compression strategy of an image region
+constexpr uint8_t REGION_NORMAL = 0;
+constexpr uint8_t REGION_RAW = 1;
+constexpr uint8_t REGION_HC = 2;
+
+/**
+ * @brief Map of the image regions which contains files with a known compression strategy. The map is built from
+ * the ISO9660 directories, so the compressor can store the media files (PSS, XA, STR...) without compression and
+ * compress the executables and archives using LZ4HC, while the rest of the image uses the selected options.
+ *
+ * The PS2 and PSP DVD images use an UDF bridge filesystem, which also contains the ISO9660 directories, so only
+ * the ISO9660 filesystem is read. The images must use sectors of 2048 bytes (CD-ROM raw images are not supported).
+ */
+class iso_file_map
+{
+public:
+    /**
+     * @brief Read the ISO9660 directories and build the regions map
+     *
+     * @param input The image
+     * @return true If the filesystem was read
+     * @return false If the image doesn't contain an ISO9660 filesystem or it is corrupted
+     */
+    bool load(ziso_input &input);
+
+    /**
+     * @brief Get the compression strategy of an image position
+     *
+     * @param position The image position
+     * @return uint8_t The region strategy (REGION_NORMAL, REGION_RAW or REGION_HC)
+     */
+    uint8_t get_strategy(uint64_t position) const;
+
+    /**
+     * @brief Get the strategy of a file, which depends on its name and extension
+     *
+     * @param filename The ISO9660 file name, with or without version
+     * @return uint8_t The file strategy
+     */
+    static uint8_t get_file_strategy(const std::string &filename);
+
+    /**
+     * @brief Get the number of files found in the filesystem
+     *
+     * @return uint64_t The number of files
+     */
+    uint64_t get_files() const;
+
+    /**
+     * @brief Get the size of the files which uses a strategy
+     *
+     * @param strategy The region strategy
+     * @return uint64_t The size in bytes
+     */
+    uint64_t get_size(uint8_t strategy) const;
+
+private:
+    struct iso_region
+    {
+        uint64_t start;
+        uint64_t end;
+        uint8_t strategy;
+    };
+
+    // Only the regions with a strategy different than REGION_NORMAL, sorted by position
+    std::vector<iso_region> regions;
+    uint64_t files = 0;
+    uint64_t sizes[3] = {0, 0, 0};
+};
\ No newline at end of file
@@ -0,0 +1,10 @@
+#pragma once
+
+// ZSO compression library
+#include "common.h"
+#include "compressor.h"
+#include "io.h"
+#include "encoder.h"
+#include "decoder.h"
+#include "reader.h"
+#include "iso.h"
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "common.h"
+#include "decoder.h"
+#include "io.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Decoded blocks kept in the reader cache by default
+constexpr uint32_t READER_CACHE_BLOCKS_DEFAULT = 256;
+// Number of independent parts of the reader cache by default
+constexpr uint16_t READER_CACHE_SHARDS_DEFAULT = 16;
+// Blocks decompressed in background after a sequential read by default
+constexpr uint32_t READER_PREFETCH_BLOCKS_DEFAULT = 16;
+// Consecutive reads required to consider that a handle is reading sequentially
+constexpr uint8_t READER_SEQUENTIAL_READS = 2;
+// Max pending prefetch requests. The oldest requests are discarded.
+constexpr uint8_t READER_PREFETCH_QUEUE_MAX = 32;
+
+/**
+ * @brief Hits and misses of a reader cache shard
+ *
+ */
+struct reader_cache_stats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t prefetched = 0;
+};
+
+/**
+ * @brief Random access reader of ZSO files. The header and the blocks index are read once, and every read only
+ * decompress the blocks which contains the requested data.
+ *
+ * The decompressed blocks are stored into a cache, so reading several times the same block (for example
+ * reading the sectors of a block one by one) only decompress it once. The reader is also an input, so the
+ * uncompressed data can be used anywhere a ziso_input is accepted.
+ *
+ * Several threads can read at the same time. The cache is splitted in shards by block number, and every shard
+ * has its own lock, which is only used when a block is not in the cache. The cached blocks are found and pinned
+ * without locking, and a block requested by several threads at the same time is decompressed only once. Every
+ * shard evicts the least recently used blocks using the CLOCK algorithm.
+ *
+ * The blocks can also be decompressed in background by a prefetch thread. The zso_reader_handle class uses it
+ * to decompress the next blocks when detects a sequential read.
+ */
+class zso_reader : public ziso_input
+{
+public:
+    /**
+     * @brief Construct a new reader
+     *
+     * @param cacheBlocks Number of decompressed blocks kept in the cache
+     * @param cacheShards Number of parts of the cache. Every part is locked independently.
+     * @param prefetchBlocks Number of blocks decompressed in background when a handle reads sequentially. 0 to disable it.
+     */
+    zso_reader(
+        uint32_t cacheBlocks = READER_CACHE_BLOCKS_DEFAULT,
+        uint16_t cacheShards = READER_CACHE_SHARDS_DEFAULT,
+        uint32_t prefetchBlocks = READER_PREFETCH_BLOCKS_DEFAULT);
+    ~zso_reader();
+
+    /**
+     * @brief Reads the header and the blocks index of the input. Must not be called while other threads are reading.
+     *
+     * @param newInput The ZSO input. Must be valid while the reader is in use.
+     * @param ignoreHeaderSize Don't check if the input size matches the size stored in the blocks index
+     * @return true If the input is a valid ZSO file
+     * @return false If the input is not a ZSO file or is damaged
+     */
+    bool open(ziso_input &newInput, bool ignoreHeaderSize = false);
+
+    /**
+     * @brief Get the uncompressed data size
+     *
+     * @return uint64_t The uncompressed size in bytes
+     */
+    uint64_t size() override;
+
+    /**
+     * @brief Read uncompressed data
+     *
+     * @param position The position of the data in the uncompressed file
+     * @param dst The destination buffer
+     * @param size The size of the data to read
+     * @return true If all the data was read
+     * @return false If there was an error or the data is beyond the end of the file
+     */
+    bool read(uint64_t position, char *dst, uint64_t size) override;
+
+    /**
+     * @brief Decompress a range of blocks in background. The compressed data of the blocks which are not in the
+     * cache is read at once, because the blocks are stored contiguously.
+     *
+     * @param firstBlock The first block to decompress
+     * @param blocksCount The number of blocks to decompress
+     */
+    void prefetch(uint32_t firstBlock, uint32_t blocksCount);
+
+    uint32_t get_prefetch_blocks() const;
+    const zheader &get_header() const;
+
+    /**
+     * @brief Get the cache hits and misses of every shard
+     *
+     * @return std::vector<reader_cache_stats> The stats of every shard
+     */
+    std::vector<reader_cache_stats> get_cache_stats() const;
+
+private:
+    // The state of every cache entry is stored in a single word, so it can be changed atomically:
+    // the block number in the high 32 bits, the entry state in the next 2 bits and the pins count in the rest.
+    static constexpr uint64_t ENTRY_EMPTY = 0;
+    static constexpr uint64_t ENTRY_LOADING = 1ULL << 30;
+    static constexpr uint64_t ENTRY_READY = 2ULL << 30;
+    static constexpr uint64_t ENTRY_STATE_MASK = 3ULL << 30;
+    static constexpr uint64_t ENTRY_PINS_MASK = (1ULL << 30) - 1;
+
+    struct cache_entry
+    {
+        std::atomic<uint64_t> state = ENTRY_EMPTY;
+        // Set when the block is used, and cleared by the CLOCK hand before evicting it
+        std::atomic<bool> referenced = false;
+        char *data = nullptr;
+    };
+
+    struct alignas(64) cache_shard
+    {
+        std::mutex mutex;
+        uint32_t firstEntry = 0;
+        uint32_t clockHand = 0;
+        std::atomic<uint64_t> hits = 0;
+        std::atomic<uint64_t> misses = 0;
+        std::atomic<uint64_t> prefetched = 0;
+    };
+
+    static uint64_t entry_state(uint32_t block, uint64_t state)
+    {
+        return ((uint64_t)block << 32) | state;
+    }
+
+    cache_entry *try_pin(uint32_t block);
+    cache_entry *pin_block(uint32_t block);
+    cache_entry *claim_entry(cache_shard &shard, uint32_t block);
+    void release_entry(cache_entry *entry, uint32_t block, bool loaded);
+    cache_entry *get_victim(cache_shard &shard, uint32_t block);
+    bool get_block_position(uint32_t block, uint64_t &startPosition, uint64_t &endPosition);
+    bool decompress(uint32_t block, const char *src, char *dst);
+    void prefetch_loop();
+    void stop_prefetch();
+
+    uint32_t cacheBlocks;
+    uint16_t cacheShards;
+    uint32_t shardEntries = 0;
+    uint32_t prefetchBlocks;
+    ziso_decoder index;
+    ziso_input *input = nullptr;
+
+    std::unique_ptr<cache_shard[]> shards;
+    std::unique_ptr<cache_entry[]> entries;
+    std::vector<char> cacheData;
+    // The cache entry of every block plus one, or 0 if the block is not in the cache
+    std::unique_ptr<std::atomic<uint32_t>[]> blockEntries;
+
+    // Background prefetch. The thread is started with the first request.
+    std::mutex prefetchMutex;
+    std::condition_variable prefetchCondition;
+    std::deque<std::pair<uint32_t, uint32_t>> prefetchQueue;
+    bool prefetchStop = false;
+    std::thread prefetchThread;
+};
+
+/**
+ * @brief Reading handle of a zso_reader. Every handle detects if its reads are sequential, and then requests the
+ * reader to decompress the next blocks in background, so they will be in the cache when they are read.
+ *
+ * A handle must be used by a single thread, but several handles of the same reader can be used at the same time.
+ */
+class zso_reader_handle : public ziso_input
+{
+public:
+    zso_reader_handle(zso_reader &reader);
+
+    uint64_t size() override;
+    bool read(uint64_t position, char *dst, uint64_t size) override;
+
+private:
+    zso_reader &reader;
+    uint64_t nextPosition = 0;
+    uint32_t sequentialReads = 0;
+    // The end of the last prefetched range
+    uint32_t prefetchEnd = 0;
+};
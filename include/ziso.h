@@ -3,127 +3,40 @@
 #include <getopt.h>
 #include <stdint.h>
 #include <iostream>
-#include <fstream>
-#include <cmath>
+#include <filesystem>
 #include <vector>
 
 #include "spdlog/spdlog.h"
-
-// The LZ4_ACCELERATION_MAX is defined in the lz4.c file and is about 65537 (now).
-// Testing I have noticed that above 1024 the compression was almost the same, so I'll set the max there.
-constexpr uint16_t LZ4_MAX_ACCELERATION = 1024;
-const std::vector<uint16_t> lz4_compression_level = {
-    LZ4_MAX_ACCELERATION,
-    uint16_t(LZ4_MAX_ACCELERATION *((float)10 / 11)),
-    uint16_t(LZ4_MAX_ACCELERATION *((float)9 / 11)),
-    uint16_t(LZ4_MAX_ACCELERATION *((float)8 / 11)),
-    uint16_t(LZ4_MAX_ACCELERATION *((float)7 / 11)),
-    uint16_t(LZ4_MAX_ACCELERATION *((float)6 / 11)),
-    uint16_t(LZ4_MAX_ACCELERATION *((float)5 / 11)),
-    uint16_t(LZ4_MAX_ACCELERATION *((float)4 / 11)),
-    uint16_t(LZ4_MAX_ACCELERATION *((float)3 / 11)),
-    uint16_t(LZ4_MAX_ACCELERATION *((float)2 / 11)),
-    uint16_t(LZ4_MAX_ACCELERATION *((float)1 / 11)),
-    1};
+#include "libziso/libziso.h"
 
 // MB Macro
 #define MB(x) ((float)(x) / 1024 / 1024)
 
-// Max Cache Size
-constexpr uint8_t CACHE_SIZE_MAX = 128;
-constexpr uint8_t CACHE_SIZE_DEFAULT = 4;
-
-#pragma pack(push)
-#pragma pack(1)
-struct zheader
-{
-    const char magic[4] = {'Z', 'I', 'S', 'O'}; // Always "ZISO".
-    const uint32_t headerSize = 0x18;           // Always 0x18.
-    uint64_t uncompressedSize = 0;              // Total size of original ISO.
-    uint32_t blockSize = 2048;                  // Size of each block, usually 2048.
-    const uint8_t version = 1;                  // Always 1.
-    uint8_t indexShift = 0;                     // Indicates left shift of index values.
-    const uint8_t unused[2] = {0, 0};           // Always 0.
-};
-#pragma pack(pop)
-
-struct opt
+// The compression options are stored in the ziso_options base
+struct opt : ziso_options
 {
     std::string inputFile = "";
     std::string outputFile = "";
     bool compress = true;
     bool blockSizeFixed = false;
-    uint32_t blockSize = 2048;
-    uint32_t cacheSize = CACHE_SIZE_DEFAULT * (1024 * 1024);
-    uint8_t compressionLevel = 12;
-    bool alternativeLz4 = false;
-    bool bruteForce = false;
-    bool lz4hc = false;
     bool overwrite = false;
-    bool hdlFix = false;
     std::string logFile = "";
     spdlog::level::level_enum logLevel = spdlog::level::err;
     bool ignoreHeaderSize = false;
     bool keepOutput = false;
-};
-
-struct summary
-{
-    uint64_t sourceSize = 0;
-    uint64_t lz4Count = 0;
-    uint64_t lz4In = 0;
-    uint64_t lz4Out = 0;
-    uint64_t lz4m2Count = 0;
-    uint64_t lz4m2In = 0;
-    uint64_t lz4m2Out = 0;
-    uint64_t lz4hcCount = 0;
-    uint64_t lz4hcIn = 0;
-    uint64_t lz4hcOut = 0;
-    uint64_t rawCount = 0;
-    uint64_t raw = 0;
+    bool mmapInput = false;
+    bool ioUring = false;
+    bool directIo = false;
+    bool dropCache = false;
+    bool useFileMap = false;
 };
 
 ///////////////////////////////
 //
 // Functions
 //
-/**
- * @brief Compress a block
- *
- * @param src The source data to "compress" (or not)
- * @param srcSize The source data size
- * @param dst The destination buffer to store the data. It must have enough space or will fail
- * @param dstSize The space in the destination buffer
- * @param uncompressed (output) True if the data was not compressed or false otherwise.
- * @param options Program options
- * @return uint32_t The compressed data size. Will return 0 if something was wrong.
- */
-inline uint32_t compress_block(
-    const char *src,
-    uint32_t srcSize,
-    char *dst,
-    uint32_t dstSize,
-    bool &uncompressed,
-    const opt &options,
-    summary &summaryData);
-
-inline uint32_t decompress_block(
-    const char *src,
-    uint32_t srcSize,
-    char *dst,
-    uint32_t dstSize,
-    bool uncompressed);
-
-bool is_cdrom(std::fstream &fIn);
-
-void file_align(
-    std::fstream &fOut,
-    uint8_t shift);
+bool is_cdrom(ziso_input &input);
 
-uint16_t buffer_align(
-    char *buffer,
-    uint64_t currentPosition,
-    uint8_t shift);
 /**
  * @brief Prints the help message
  *
@@ -0,0 +1,702 @@
+#include "libziso/compressor.h"
+#include "xxhash.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+static uint32_t compress_data(
+    const char *src,
+    uint32_t srcSize,
+    char *dst,
+    uint32_t dstSize,
+    bool &uncompressed,
+    const ziso_options &options,
+    compression_context &context,
+    summary &summaryData);
+
+/**
+ * @brief Clear the counters of the checks and searches done while compressing a block. The copies of a block don't
+ * repeat them, so only the counters of its output are added on every copy.
+ *
+ * @param blockSummary The summary of the compressed block
+ */
+static void clear_sampled_counters(summary &blockSummary)
+{
+    blockSummary.entropyChecked = 0;
+    blockSummary.entropyWrong = 0;
+    blockSummary.entropyWrongLost = 0;
+    blockSummary.exhaustiveAttempts = 0;
+    blockSummary.exhaustivePruned = 0;
+    blockSummary.twoTierChecked = 0;
+    blockSummary.twoTierCheckedLost = 0;
+    blockSummary.twoTierCheckedTime = 0;
+    blockSummary.favorChecked = 0;
+    blockSummary.favorCheckedIn = 0;
+    blockSummary.favorCheckedOut = 0;
+    blockSummary.favorCheckedTime = 0;
+    blockSummary.normalCheckedOut = 0;
+    blockSummary.normalCheckedTime = 0;
+}
+
+duplicates_cache::duplicates_cache(uint64_t maxSize)
+    : shardMaxSize(maxSize / SHARDS),
+      shards(new cache_shard[SHARDS])
+{
+}
+
+uint32_t duplicates_cache::find(uint64_t hash, const char *src, uint32_t srcSize, char *dst, uint32_t dstSize, bool &uncompressed, summary &blockSummary)
+{
+    cache_shard &shard = shards[hash % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto entry = shard.entries.find(hash);
+    if (entry == shard.entries.end() ||
+        entry->second.data.size() != srcSize ||
+        entry->second.compressedData.size() > dstSize ||
+        std::memcmp(entry->second.data.data(), src, srcSize) != 0)
+    {
+        return 0;
+    }
+
+    std::memcpy(dst, entry->second.compressedData.data(), entry->second.compressedData.size());
+    uncompressed = entry->second.uncompressed;
+    blockSummary = entry->second.blockSummary;
+
+    return entry->second.compressedData.size();
+}
+
+void duplicates_cache::insert(uint64_t hash, const char *src, uint32_t srcSize, const char *compressed, uint32_t compressedSize, bool uncompressed, const summary &blockSummary)
+{
+    // The memory of the map node is also included
+    uint64_t entrySize = srcSize + compressedSize + sizeof(cache_entry) + 64;
+    if (entrySize > shardMaxSize)
+    {
+        return;
+    }
+
+    cache_shard &shard = shards[hash % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    if (shard.entries.contains(hash))
+    {
+        return;
+    }
+
+    // Remove the oldest entries until the new one fits
+    while (shard.size + entrySize > shardMaxSize && !shard.order.empty())
+    {
+        auto oldest = shard.entries.find(shard.order.front());
+        shard.size -= oldest->second.data.size() + oldest->second.compressedData.size() + sizeof(cache_entry) + 64;
+        shard.entries.erase(oldest);
+        shard.order.pop_front();
+    }
+
+    shard.entries.emplace(hash, cache_entry{
+                                    std::vector<char>(src, src + srcSize),
+                                    std::vector<char>(compressed, compressed + compressedSize),
+                                    uncompressed,
+                                    blockSummary});
+    shard.order.push_back(hash);
+    shard.size += entrySize;
+}
+
+compression_key::compression_key(const ziso_options &options)
+    : compressionLevel(options.compressionLevel),
+      alternativeLz4(options.alternativeLz4),
+      lz4hc(options.lz4hc),
+      bruteForce(options.bruteForce),
+      exhaustive(options.exhaustive),
+      twoTier(options.twoTier),
+      twoTierMinRatio(options.twoTierMinRatio),
+      twoTierMaxRatio(options.twoTierMaxRatio),
+      favorDecompression(options.favorDecompression),
+      minSaving(options.minSaving),
+      entropyThreshold(options.entropyThreshold)
+{
+}
+
+uint64_t compression_key::hash() const
+{
+    // The fields are packed to avoid hashing the struct padding
+    uint32_t thresholdBits;
+    std::memcpy(&thresholdBits, &entropyThreshold, sizeof(thresholdBits));
+    uint64_t packed[2] = {
+        lz4hc | (bruteForce << 1) | (exhaustive << 2) | (twoTier << 3) | (alternativeLz4 << 4) | (favorDecompression << 5) |
+            ((uint64_t)compressionLevel << 8) | ((uint64_t)minSaving << 16) | ((uint64_t)twoTierMinRatio << 24) | ((uint64_t)twoTierMaxRatio << 32),
+        thresholdBits};
+    return XXH64(packed, sizeof(packed), 0);
+}
+
+compression_context::compression_context(const ziso_options &options)
+    : lz4Buffer(LZ4_compressBound(options.blockSize), 0),
+      lz4Method2Buffer(LZ4_compressBound(options.blockSize), 0),
+      zeroBlock(LZ4_compressBound(options.blockSize), 0),
+      zeroBlockKey(options)
+{
+    if (options.entropyThreshold > 0)
+    {
+        // The entropy is calculated using the count * log2(count) of every byte value
+        entropyTable.resize(options.blockSize + 1, 0);
+        for (uint32_t count = 1; count <= options.blockSize; count++)
+        {
+            entropyTable[count] = count * std::log2((float)count);
+        }
+        entropyCheckBuffer.resize(options.blockSize, 0);
+    }
+    if (options.favorDecompression)
+    {
+        favorDecodeBuffer.resize(options.blockSize, 0);
+    }
+
+    // The states must be initialized once before using the fast reset functions
+    LZ4_initStream(&lz4State, sizeof(lz4State));
+    LZ4_initStream(&lz4Method2State, sizeof(lz4Method2State));
+    LZ4_initStreamHC(&lz4hcState, sizeof(lz4hcState));
+
+    // Compress a zero filled block using the same method than the rest of blocks
+    std::vector<char> zeroes(options.blockSize, 0);
+    uint32_t zeroBlockSize = compress_data(zeroes.data(), zeroes.size(), zeroBlock.data(), zeroBlock.size(), zeroBlockUncompressed, options, *this, zeroBlockSummary);
+    zeroBlock.resize(zeroBlockSize);
+    clear_sampled_counters(zeroBlockSummary);
+}
+
+/**
+ * @brief Reset the LZ4HC state to compress a new block. The fast reset keeps the decompression speed preference of
+ * the previous block, so it's always set.
+ *
+ * @param context The compression context with the LZ4HC state
+ * @param level The LZ4HC compression level
+ * @param favorDecompression Avoid the matches which are slow to decompress
+ */
+static void reset_hc_state(compression_context &context, int level, bool favorDecompression)
+{
+    LZ4_resetStreamHC_fast(&context.lz4hcState, level);
+    LZ4_favorDecompressionSpeed(&context.lz4hcState, favorDecompression);
+}
+
+/**
+ * @brief Decompress a block several times and get the fastest decompression time
+ *
+ * @param src The compressed data
+ * @param srcSize The compressed size
+ * @param dst The buffer for the decompressed data
+ * @param dstSize The decompressed size
+ * @return uint64_t The decompression time in nanoseconds
+ */
+static uint64_t decode_time(const char *src, uint32_t srcSize, char *dst, uint32_t dstSize)
+{
+    uint64_t fastest = UINT64_MAX;
+    for (uint32_t decode = 0; decode < FAVOR_CHECK_DECODES; decode++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        LZ4_decompress_safe(src, dst, srcSize, dstSize);
+        auto end = std::chrono::steady_clock::now();
+        fastest = std::min(fastest, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+    return fastest;
+}
+
+bool is_zero_block(const char *src, uint32_t srcSize)
+{
+    uint32_t position = 0;
+    for (; position + 64 <= srcSize; position += 64)
+    {
+        uint64_t words[8];
+        std::memcpy(words, src + position, sizeof(words));
+
+        uint64_t merged = 0;
+        for (uint64_t word : words)
+        {
+            merged |= word;
+        }
+        if (merged)
+        {
+            return false;
+        }
+    }
+
+    for (; position < srcSize; position++)
+    {
+        if (src[position])
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Calculate the Shannon entropy of the block bytes. The histogram is splitted into four, so the consecutive
+ * bytes update different counters and the CPU can process several of them at the same time.
+ *
+ * @param src The block data
+ * @param srcSize The block size
+ * @param entropyTable The count * log2(count) table
+ * @return float The entropy in bits per byte, between 0 and 8
+ */
+static float block_entropy(const char *src, uint32_t srcSize, const std::vector<float> &entropyTable)
+{
+    uint32_t histograms[4][256] = {};
+    const uint8_t *data = (const uint8_t *)src;
+
+    uint32_t position = 0;
+    for (; position + 4 <= srcSize; position += 4)
+    {
+        histograms[0][data[position]]++;
+        histograms[1][data[position + 1]]++;
+        histograms[2][data[position + 2]]++;
+        histograms[3][data[position + 3]]++;
+    }
+    for (; position < srcSize; position++)
+    {
+        histograms[0][data[position]]++;
+    }
+
+    float sum = 0;
+    for (uint16_t value = 0; value < 256; value++)
+    {
+        uint32_t count = histograms[0][value] + histograms[1][value] + histograms[2][value] + histograms[3][value];
+        sum += count < entropyTable.size() ? entropyTable[count] : count * std::log2((float)count);
+    }
+
+    return std::log2((float)srcSize) - sum / srcSize;
+}
+
+uint32_t compress_block(
+    const char *src,
+    uint32_t srcSize,
+    char *dst,
+    uint32_t dstSize,
+    bool &uncompressed,
+    const ziso_options &options,
+    compression_context &context,
+    summary &summaryData)
+{
+    // The zero filled blocks are very common in the disc images, and their compressed data is always the same
+    compression_key key(options);
+    if (srcSize == options.blockSize &&
+        !context.zeroBlock.empty() &&
+        key == context.zeroBlockKey &&
+        context.zeroBlock.size() <= dstSize &&
+        is_zero_block(src, srcSize))
+    {
+        std::memcpy(dst, context.zeroBlock.data(), context.zeroBlock.size());
+        uncompressed = context.zeroBlockUncompressed;
+
+        summaryData += context.zeroBlockSummary;
+        summaryData.zeroCount++;
+
+        return context.zeroBlock.size();
+    }
+
+    if (!context.duplicates)
+    {
+        return compress_data(src, srcSize, dst, dstSize, uncompressed, options, context, summaryData);
+    }
+
+    // Search the block in the cache, and add it if it was not found. The blocks compressed with different methods
+    // are stored with a different seed, so they are not mixed when the file map is used.
+    uint64_t hash = XXH64(src, srcSize, key.hash());
+    summary blockSummary;
+    summaryData.duplicatesLookups++;
+    if (uint32_t cachedSize = context.duplicates->find(hash, src, srcSize, dst, dstSize, uncompressed, blockSummary);
+        cachedSize)
+    {
+        summaryData += blockSummary;
+        summaryData.duplicatesHits++;
+        return cachedSize;
+    }
+
+    uint32_t outSize = compress_data(src, srcSize, dst, dstSize, uncompressed, options, context, blockSummary);
+    summaryData += blockSummary;
+    if (outSize)
+    {
+        // The checks are done only once
+        clear_sampled_counters(blockSummary);
+        context.duplicates->insert(hash, src, srcSize, dst, outSize, uncompressed, blockSummary);
+    }
+
+    return outSize;
+}
+
+static uint32_t compress_data(
+    const char *src,
+    uint32_t srcSize,
+    char *dst,
+    uint32_t dstSize,
+    bool &uncompressed,
+    const ziso_options &options,
+    compression_context &context,
+    summary &summaryData)
+{
+    // The source size will be the same always
+    summaryData.sourceSize += srcSize;
+
+    // Try to compress the data into the dst buffer
+    uint32_t outSize = 0;
+    // The two-tier compression used the LZ4 output
+    bool twoTierFast = false;
+    // The outputs equal or bigger than this size are stored raw, because they are faster to read than to decompress.
+    // The decode cost model reads the saved bytes at the read speed and decompresses the whole block at the LZ4 speed.
+    uint32_t rawSize = srcSize - (options.minSaving == MIN_SAVING_MODEL
+                                      ? ((uint64_t)srcSize * DECODE_MODEL_READ_SPEED) / DECODE_MODEL_LZ4_SPEED
+                                      : ((uint64_t)srcSize * options.minSaving) / 100);
+
+    // The blocks with a high entropy (compressed or encrypted data) will not be compressed, so they are stored raw
+    bool entropySkip = options.entropyThreshold > 0 &&
+                       srcSize > 0 &&
+                       block_entropy(src, srcSize, context.entropyTable) >= options.entropyThreshold;
+    if (entropySkip)
+    {
+        summaryData.entropySkipped++;
+
+        // Some of the skipped blocks are compressed anyway to check the prediction. The result is not used, so the
+        // output doesn't depend on which blocks are checked.
+        if (++context.entropySkippedBlocks % ENTROPY_CHECK_INTERVAL == 0)
+        {
+            ziso_options checkOptions = options;
+            checkOptions.entropyThreshold = 0;
+
+            bool checkUncompressed = false;
+            summary checkSummary;
+            uint32_t checkSize = compress_data(src, srcSize, context.entropyCheckBuffer.data(), context.entropyCheckBuffer.size(), checkUncompressed, checkOptions, context, checkSummary);
+
+            summaryData.entropyChecked++;
+            if (checkSize && !checkUncompressed)
+            {
+                summaryData.entropyWrong++;
+                summaryData.entropyWrongLost += srcSize - checkSize;
+            }
+        }
+    }
+    else if (options.exhaustive)
+    {
+        // Try every LZ4HC level and every LZ4 acceleration in both modes, and keep the smallest output. Every attempt
+        // only has space for an output smaller than the current best, so LZ4 stops as soon as it cannot win.
+        std::vector<char> *candidate = &context.lz4Buffer;
+        std::vector<char> *best = &context.lz4Method2Buffer;
+        uint32_t bestSize = 0;
+        uint8_t bestMethod = 0;
+
+        auto capacity = [&]()
+        {
+            // An output equal or bigger than the source will be stored raw
+            return bestSize ? bestSize - 1 : srcSize - 1;
+        };
+        auto add_candidate = [&](uint32_t candidateSize, uint8_t method)
+        {
+            summaryData.exhaustiveAttempts++;
+            if (candidateSize == 0)
+            {
+                summaryData.exhaustivePruned++;
+                return;
+            }
+            bestSize = candidateSize;
+            bestMethod = method;
+            std::swap(candidate, best);
+        };
+
+        // The higher levels usually produce the smallest output, so they are tried first to prune the rest earlier
+        for (int level = LZ4HC_CLEVEL_MAX; level >= 1 && capacity() > 0; level--)
+        {
+            reset_hc_state(context, level, false);
+            add_candidate(LZ4_compress_HC_continue(&context.lz4hcState, src, candidate->data(), srcSize, capacity()), EXHAUSTIVE_LZ4HC);
+        }
+        for (auto acceleration = lz4_compression_level.rbegin(); acceleration != lz4_compression_level.rend() && capacity() > 0; acceleration++)
+        {
+            LZ4_resetStream(&context.lz4State);
+            add_candidate(LZ4_compress_fast_continue(&context.lz4State, src, candidate->data(), srcSize, capacity(), *acceleration), EXHAUSTIVE_LZ4);
+            if (capacity() > 0)
+            {
+                add_candidate(LZ4_compress_fast_extState_fastReset(&context.lz4Method2State, src, candidate->data(), srcSize, capacity(), *acceleration), EXHAUSTIVE_LZ4_MODE2);
+            }
+        }
+
+        if (bestSize > 0)
+        {
+            outSize = bestSize;
+            std::memcpy(dst, best->data(), bestSize);
+        }
+        if (bestSize > 0 && bestSize < rawSize)
+        {
+            if (bestMethod == EXHAUSTIVE_LZ4HC)
+            {
+                summaryData.lz4hcCount++;
+                summaryData.lz4hcIn += srcSize;
+                summaryData.lz4hcOut += outSize;
+            }
+            else if (bestMethod == EXHAUSTIVE_LZ4_MODE2)
+            {
+                summaryData.lz4m2Count++;
+                summaryData.lz4m2In += srcSize;
+                summaryData.lz4m2Out += outSize;
+            }
+            else
+            {
+                summaryData.lz4Count++;
+                summaryData.lz4In += srcSize;
+                summaryData.lz4Out += outSize;
+            }
+        }
+    }
+    else if (options.bruteForce)
+    {
+        // This method will try all the available compression methods to select the most apropiate.
+        uint32_t lz4Size = 0;
+        uint32_t lz4Method2Size = 0;
+
+        std::vector<char> &lz4Buffer = context.lz4Buffer;
+        std::vector<char> &lz4Method2Buffer = context.lz4Method2Buffer;
+
+        // Compress using the standard methods
+        // Method 1
+        LZ4_resetStream(&context.lz4State);
+        lz4Size = LZ4_compress_fast_continue(&context.lz4State, src, lz4Buffer.data(), srcSize, dstSize, lz4_compression_level[options.compressionLevel - 1]);
+        // Method 2
+        lz4Method2Size = LZ4_compress_fast_extState_fastReset(&context.lz4Method2State, src, lz4Method2Buffer.data(), srcSize, dstSize, lz4_compression_level[options.compressionLevel - 1]);
+
+        // Get the smaller output between all the methods
+        if (lz4Size > 0 && (lz4Size < outSize || outSize == 0))
+        {
+            outSize = lz4Size;
+        }
+        if (lz4Method2Size > 0 && (lz4Method2Size < outSize || outSize == 0))
+        {
+            outSize = lz4Method2Size;
+        }
+
+        // If there was an error compressing or the size is bigger than source, don't do anything.
+        if (outSize == 0 || outSize >= rawSize)
+        {
+            // The raw data will be copied later
+        }
+        // The methods priority are LZ4, LZ4 Method 2.
+        else if (lz4Size > 0 && outSize == lz4Size)
+        {
+            std::memcpy(dst, lz4Buffer.data(), lz4Size);
+
+            summaryData.lz4Count++;
+            summaryData.lz4In += srcSize;
+            summaryData.lz4Out += outSize;
+        }
+        else if (lz4Method2Size > 0 && outSize == lz4Method2Size)
+        {
+            std::memcpy(dst, lz4Method2Buffer.data(), lz4Method2Size);
+
+            summaryData.lz4m2Count++;
+            summaryData.lz4m2In += srcSize;
+            summaryData.lz4m2Out += outSize;
+        }
+        else
+        {
+            // Something weird
+            return 0;
+        }
+    }
+    else
+    {
+        if (options.lz4hc && options.twoTier)
+        {
+            // Compress using the fastest LZ4 first, and use LZ4HC only if the LZ4 ratio is in the promising band
+            auto fastStart = std::chrono::steady_clock::now();
+            LZ4_resetStream(&context.lz4State);
+            uint32_t fastSize = LZ4_compress_fast_continue(&context.lz4State, src, context.lz4Buffer.data(), srcSize, context.lz4Buffer.size(), 1);
+            uint32_t fastRatio = (fastSize > 0 && fastSize < srcSize) ? ((uint64_t)fastSize * 100) / srcSize : 100;
+            auto hcStart = std::chrono::steady_clock::now();
+            summaryData.twoTierFastTime += std::chrono::duration_cast<std::chrono::nanoseconds>(hcStart - fastStart).count();
+
+            if (fastRatio > options.twoTierMinRatio && fastRatio < options.twoTierMaxRatio)
+            {
+                summaryData.twoTierHc++;
+                reset_hc_state(context, options.compressionLevel, options.favorDecompression);
+                outSize = LZ4_compress_HC_continue(&context.lz4hcState, src, dst, srcSize, dstSize);
+                summaryData.twoTierHcTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - hcStart).count();
+            }
+            else
+            {
+                summaryData.twoTierSkipped++;
+
+                // Some of the skipped blocks are compressed using LZ4HC anyway to measure the lost bytes. The result
+                // is not used, so the output doesn't depend on which blocks are checked.
+                if (++context.twoTierSkippedBlocks % TWO_TIER_CHECK_INTERVAL == 0)
+                {
+                    reset_hc_state(context, options.compressionLevel, options.favorDecompression);
+                    uint32_t checkSize = LZ4_compress_HC_continue(&context.lz4hcState, src, context.lz4Method2Buffer.data(), srcSize, context.lz4Method2Buffer.size());
+                    summaryData.twoTierCheckedTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - hcStart).count();
+                    uint32_t storedSize = fastRatio < 100 ? fastSize : srcSize;
+                    uint32_t checkStoredSize = (checkSize > 0 && checkSize < srcSize) ? checkSize : srcSize;
+
+                    summaryData.twoTierChecked++;
+                    if (checkStoredSize < storedSize)
+                    {
+                        summaryData.twoTierCheckedLost += storedSize - checkStoredSize;
+                    }
+                }
+            }
+
+            // LZ4HC is not always smaller than LZ4
+            if (fastRatio < 100 && (outSize == 0 || fastSize < outSize) && fastSize <= dstSize)
+            {
+                std::memcpy(dst, context.lz4Buffer.data(), fastSize);
+                outSize = fastSize;
+                twoTierFast = true;
+            }
+        }
+        else if (options.lz4hc)
+        {
+            reset_hc_state(context, options.compressionLevel, options.favorDecompression);
+            outSize = LZ4_compress_HC_continue(&context.lz4hcState, src, dst, srcSize, dstSize);
+        }
+        else
+        {
+            if (options.alternativeLz4)
+            {
+                outSize = LZ4_compress_fast_extState_fastReset(&context.lz4Method2State, src, dst, srcSize, dstSize, lz4_compression_level[options.compressionLevel - 1]);
+            }
+            else
+            {
+                LZ4_resetStream(&context.lz4State);
+                outSize = LZ4_compress_fast_continue(&context.lz4State, src, dst, srcSize, dstSize, lz4_compression_level[options.compressionLevel - 1]);
+            }
+        }
+    }
+
+    // If the block was not compressed because a buffer space problem, or the output is bigger than input
+    //
+    if (outSize == 0 || outSize >= rawSize)
+    {
+        if (dstSize < srcSize)
+        {
+            // The block cannot be compressed and the raw data doesn't fit the dst buffer
+            return 0;
+        }
+        uncompressed = true;
+        std::memcpy(dst, src, srcSize);
+
+        if (outSize > 0 && outSize < srcSize)
+        {
+            summaryData.minSavingRaw++;
+            summaryData.minSavingIn += srcSize;
+            summaryData.minSavingLost += srcSize - outSize;
+        }
+
+        if (options.entropyThreshold > 0 && !entropySkip)
+        {
+            summaryData.entropyMissed++;
+        }
+        summaryData.rawCount++;
+        summaryData.raw += srcSize;
+
+        return srcSize;
+    }
+    else
+    {
+        uncompressed = false;
+
+        // When brute force or the exhaustive search are used, summary data is added before.
+        if (!options.bruteForce && !options.exhaustive)
+        {
+            if (options.lz4hc && !twoTierFast)
+            {
+                summaryData.lz4hcCount++;
+                summaryData.lz4hcIn += srcSize;
+                summaryData.lz4hcOut += outSize;
+
+                // Some blocks are also compressed using the normal LZ4HC to compare the size and the decode speed
+                if (options.favorDecompression && ++context.favorBlocks % FAVOR_CHECK_INTERVAL == 0)
+                {
+                    reset_hc_state(context, options.compressionLevel, false);
+                    uint32_t normalSize = LZ4_compress_HC_continue(&context.lz4hcState, src, context.lz4Method2Buffer.data(), srcSize, context.lz4Method2Buffer.size());
+
+                    if (normalSize > 0 && normalSize < srcSize)
+                    {
+                        summaryData.favorChecked++;
+                        summaryData.favorCheckedIn += srcSize;
+                        summaryData.favorCheckedOut += outSize;
+                        summaryData.favorCheckedTime += decode_time(dst, outSize, context.favorDecodeBuffer.data(), srcSize);
+                        summaryData.normalCheckedOut += normalSize;
+                        summaryData.normalCheckedTime += decode_time(context.lz4Method2Buffer.data(), normalSize, context.favorDecodeBuffer.data(), srcSize);
+                    }
+                }
+            }
+            else
+            {
+                if (options.alternativeLz4 && !twoTierFast)
+                {
+                    summaryData.lz4m2Count++;
+                    summaryData.lz4m2In += srcSize;
+                    summaryData.lz4m2Out += outSize;
+                }
+                else
+                {
+                    summaryData.lz4Count++;
+                    summaryData.lz4In += srcSize;
+                    summaryData.lz4Out += outSize;
+                }
+            }
+        }
+
+        return outSize;
+    }
+}
+
+uint32_t store_block(
+    const char *src,
+    uint32_t srcSize,
+    char *dst,
+    uint32_t dstSize,
+    bool &uncompressed,
+    summary &summaryData)
+{
+    if (dstSize < srcSize)
+    {
+        return 0;
+    }
+
+    uncompressed = true;
+    std::memcpy(dst, src, srcSize);
+
+    summaryData.sourceSize += srcSize;
+    summaryData.rawCount++;
+    summaryData.raw += srcSize;
+
+    return srcSize;
+}
+
+uint32_t decompress_block(
+    const char *src,
+    uint32_t srcSize,
+    char *dst,
+    uint32_t dstSize,
+    bool uncompressed)
+{
+    if (uncompressed)
+    {
+        // If the data is non compressed, then just copy the source data
+        if (dstSize > srcSize)
+        {
+            // The raw input data is less than the buffer
+            return 0;
+        }
+
+        std::memcpy(dst, src, dstSize);
+        return dstSize;
+    }
+    else
+    {
+        return LZ4_decompress_safe_partial(src, dst, srcSize, dstSize, dstSize);
+    }
+}
+
+uint16_t buffer_align(char *buffer, uint64_t currentPosition, uint8_t shift)
+{
+    if (uint16_t paddingLostBytes = currentPosition % (1 << shift);
+        paddingLostBytes)
+    {
+        uint16_t alignment = (1 << shift) - paddingLostBytes;
+        std::memset(buffer, 0, alignment);
+        return alignment;
+    }
+    return 0;
+}
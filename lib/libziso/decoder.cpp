@@ -0,0 +1,248 @@
+#include "libziso/decoder.h"
+#include "libziso/compressor.h"
+#include <atomic>
+#include <thread>
+
+#include "spdlog/spdlog.h"
+
+ziso_decoder::ziso_decoder(uint16_t threads, uint32_t cacheSize)
+    : threads(threads ? threads : 1),
+      cacheSize(cacheSize)
+{
+}
+
+void ziso_decoder::set_progress_callback(progress_callback callback)
+{
+    progress = callback;
+}
+
+bool ziso_decoder::open(ziso_input &newInput, bool ignoreHeaderSize)
+{
+    input = &newInput;
+    inputSize = input->size();
+    spdlog::debug("The input file size is {} bytes.", inputSize);
+
+    // Read the header
+    if (!input->read(0, reinterpret_cast<char *>(&fileHeader), sizeof(fileHeader)))
+    {
+        spdlog::error("There was an error reading the input file header.");
+        return false;
+    }
+    if (fileHeader.magic[0] != 'Z' || fileHeader.magic[1] != 'I' || fileHeader.magic[2] != 'S' || fileHeader.magic[3] != 'O')
+    {
+        spdlog::error("The input file is not a ZISO file.");
+        return false;
+    }
+    if (fileHeader.blockSize == 0)
+    {
+        spdlog::error("The input file header is corrupt. Wrong block size.");
+        return false;
+    }
+
+    // Calculate the blocks number
+    uint32_t blocksNumber = ((fileHeader.uncompressedSize + fileHeader.blockSize - 1) / fileHeader.blockSize) + 1;
+    spdlog::debug("Number of blocks in file: {}.", blocksNumber - 1);
+
+    // Reserve and read the blocks index
+    blocks.assign(blocksNumber, 0);
+    if (!input->read(sizeof(fileHeader), (char *)blocks.data(), blocksNumber * sizeof(uint32_t)))
+    {
+        spdlog::error("The input file header is corrupt. The blocks index cannot be read.");
+        return false;
+    }
+
+    // Check if the input file is damaged
+    uint64_t headerFileSize = uint64_t(blocks[blocksNumber - 1] & 0x7FFFFFFF) << fileHeader.indexShift;
+    // Check if the file was fixed against the hdl_dump bug
+    uint64_t hdlFixHeaderFileSize = headerFileSize;
+    if (headerFileSize % 2048)
+    {
+        hdlFixHeaderFileSize = ((headerFileSize >> 11) + 1) << 11;
+    }
+
+    if (headerFileSize != inputSize && hdlFixHeaderFileSize != inputSize && ignoreHeaderSize == false)
+    {
+        // The input file doesn't matches the index data and maybe is damaged
+        spdlog::error("The input file header is corrupt. Filesize doesn't matches.");
+        spdlog::debug("Input file size: {} - Header file size: {} - hdlFixed size: {}.", inputSize, headerFileSize, hdlFixHeaderFileSize);
+        return false;
+    }
+
+    return true;
+}
+
+bool ziso_decoder::decode(ziso_output &output)
+{
+    if (!input)
+    {
+        spdlog::error("There is no input to decode.");
+        return false;
+    }
+
+    uint32_t blocksNumber = blocks.size() - 1;
+
+    // Every thread will process ranges of blocks. The cache is splitted between all the threads.
+    uint32_t rangeBlocks = (cacheSize / threads) / fileHeader.blockSize;
+    if (rangeBlocks == 0)
+    {
+        rangeBlocks = 1;
+    }
+    spdlog::debug("Decompressing using {} threads. Every thread will decompress ranges of {} blocks.", threads, rangeBlocks);
+
+    std::atomic<uint32_t> nextBlock = 0;
+    std::atomic<uint64_t> processedInput = 0;
+    std::atomic<bool> failed = false;
+
+    // The buffers of every thread are reserved before starting, so they can be registered in the input and the
+    // output. A compressed range cannot be bigger than the double of the decompressed range.
+    std::vector<std::vector<char>> readBuffers(threads);
+    std::vector<std::vector<char>> writeBuffers(threads);
+    for (uint16_t i = 0; i < threads; i++)
+    {
+        readBuffers[i].resize((uint64_t)rangeBlocks * fileHeader.blockSize * 2, 0);
+        writeBuffers[i].resize((uint64_t)rangeBlocks * fileHeader.blockSize, 0);
+        input->register_buffer(readBuffers[i].data(), readBuffers[i].size());
+        output.register_buffer(writeBuffers[i].data(), writeBuffers[i].size());
+    }
+
+    auto worker = [&](uint16_t thread)
+    {
+        std::vector<char> &readBuffer = readBuffers[thread];
+        std::vector<char> &writeBuffer = writeBuffers[thread];
+
+        while (!failed)
+        {
+            uint32_t firstBlock = nextBlock.fetch_add(rangeBlocks);
+            if (firstBlock >= blocksNumber)
+            {
+                break;
+            }
+            uint32_t lastBlock = std::min(firstBlock + rangeBlocks, blocksNumber);
+
+            // The compressed range of the blocks is contiguous, so it is read at once
+            uint64_t rangeStartPosition = uint64_t(blocks[firstBlock] & 0x7FFFFFFF) << fileHeader.indexShift;
+            uint64_t rangeEndPosition = uint64_t(blocks[lastBlock] & 0x7FFFFFFF) << fileHeader.indexShift;
+            if (rangeEndPosition < rangeStartPosition ||
+                rangeEndPosition > inputSize ||
+                (rangeEndPosition - rangeStartPosition) > ((uint64_t)(lastBlock - firstBlock) * fileHeader.blockSize * 2))
+            {
+                spdlog::error("The input file header is corrupt. Corrupted index block.");
+                failed = true;
+                break;
+            }
+
+            if (!input->read(rangeStartPosition, readBuffer.data(), rangeEndPosition - rangeStartPosition))
+            {
+                spdlog::error("There was an error reading the input file.");
+                failed = true;
+                break;
+            }
+
+            uint64_t writeBufferPos = 0;
+            for (uint32_t currentBlock = firstBlock; currentBlock < lastBlock; currentBlock++)
+            {
+                bool uncompressed = blocks[currentBlock] & 0x80000000;
+                uint64_t blockStartPosition = uint64_t(blocks[currentBlock] & 0x7FFFFFFF) << fileHeader.indexShift;
+                uint64_t blockEndPosition = uint64_t(blocks[currentBlock + 1] & 0x7FFFFFFF) << fileHeader.indexShift;
+
+                // The current block size cannot exceed 2 x blockSize.
+                if (blockEndPosition < blockStartPosition ||
+                    (blockEndPosition - blockStartPosition) > (fileHeader.blockSize * 2))
+                {
+                    spdlog::error("The input file header is corrupt. Corrupted index block.");
+                    failed = true;
+                    break;
+                }
+
+                // The last block can be smaller than the block size if the input size is not a block size multiple
+                uint32_t decompressedBlockSize = fileHeader.blockSize;
+                if (uint64_t leftInOutput = fileHeader.uncompressedSize - ((uint64_t)currentBlock * fileHeader.blockSize);
+                    leftInOutput < decompressedBlockSize)
+                {
+                    decompressedBlockSize = leftInOutput;
+                }
+
+                uint32_t decompressedBytes = decompress_block(
+                    readBuffer.data() + (blockStartPosition - rangeStartPosition),
+                    blockEndPosition - blockStartPosition,
+                    writeBuffer.data() + writeBufferPos,
+                    decompressedBlockSize,
+                    uncompressed);
+
+                if (decompressedBytes != decompressedBlockSize)
+                {
+                    spdlog::error("There was an error decompressing the source file.");
+                    failed = true;
+                    break;
+                }
+                writeBufferPos += decompressedBytes;
+            }
+
+            if (failed)
+            {
+                break;
+            }
+
+            // Write the decompressed blocks at their final position
+            if (!output.write((uint64_t)firstBlock * fileHeader.blockSize, writeBuffer.data(), writeBufferPos))
+            {
+                spdlog::error("There was an error writing the output file.");
+                failed = true;
+                break;
+            }
+
+            processedInput += rangeEndPosition - rangeStartPosition;
+            if (thread == 0 && progress)
+            {
+                progress(processedInput, inputSize);
+            }
+        }
+    };
+
+    // The calling thread also decompress blocks and reports the progress
+    std::vector<std::thread> workers;
+    for (uint16_t i = 1; i < threads; i++)
+    {
+        workers.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto &thread : workers)
+    {
+        thread.join();
+    }
+
+    for (uint16_t i = 0; i < threads; i++)
+    {
+        input->unregister_buffer(readBuffers[i].data());
+        output.unregister_buffer(writeBuffers[i].data());
+    }
+
+    return !failed;
+}
+
+bool ziso_decoder::decode(const char *src, uint64_t srcSize, std::vector<char> &dst, uint16_t threads)
+{
+    ziso_decoder decoder(threads);
+    memory_input input(src, srcSize);
+    memory_output output;
+
+    if (!decoder.open(input) || !decoder.decode(output))
+    {
+        return false;
+    }
+
+    dst = std::move(output.get_data());
+    // The output is resized to the uncompressed size in case the data ends with empty blocks
+    dst.resize(decoder.get_header().uncompressedSize, 0);
+    return true;
+}
+
+const zheader &ziso_decoder::get_header() const
+{
+    return fileHeader;
+}
+
+const std::vector<uint32_t> &ziso_decoder::get_blocks() const
+{
+    return blocks;
+}
@@ -0,0 +1,1003 @@
+#include "libziso/encoder.h"
+#include "libziso/compressor.h"
+#include "libziso/iso.h"
+#include "threads.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "spdlog/spdlog.h"
+
+ziso_encoder::ziso_encoder(const ziso_options &options)
+    : options(options)
+{
+}
+
+ziso_encoder::~ziso_encoder()
+{
+    // The writer thread must finish before the buffers are released
+    writer.reset();
+    compressor.reset();
+}
+
+void ziso_encoder::set_progress_callback(progress_callback callback)
+{
+    progress = callback;
+}
+
+bool ziso_encoder::begin(ziso_output &newOutput, uint64_t uncompressedSize)
+{
+    output = &newOutput;
+    inputPosition = 0;
+    currentBlock = 0;
+    pendingSize = 0;
+    writeBufferPos = 0;
+    writeFailed = false;
+    layoutOverflow = false;
+    lastBlockPosition = 0;
+    layoutSummary = summary();
+
+    // The time limits start with the fastest tier. The target size tiers were already selected by the input sampling
+    // of the encode methods, and the streaming methods, which cannot sample the input, also start with the fastest
+    // tier and measure the ratio of every chunk. The encode methods start the time and build the tiers once, so the
+    // passes compressed again to increase the index shift use the remaining time and the throughputs measured by the
+    // previous passes.
+    bool timeLimits = !options.targetSize && (options.maxTime || options.minThroughput > 0);
+    bool targetWritten = options.targetSize && !encoding;
+    if (!encoding)
+    {
+        tiers.clear();
+        targetSampledInput.clear();
+        if (timeLimits || targetWritten)
+        {
+            build_tiers();
+        }
+        timeStart = std::chrono::steady_clock::now();
+    }
+    if (timeLimits || targetWritten)
+    {
+        options = tiers[0].options;
+    }
+    chunkInput = 0;
+
+    // Get the total blocks
+    blocksNumber = ((uncompressedSize + options.blockSize - 1) / options.blockSize) + 1;
+    spdlog::debug("Number of blocks in file: {}.", blocksNumber - 1);
+    spdlog::debug("Last block size: {}. (0 means 'BlockSize')", uncompressedSize % options.blockSize);
+    // Calculate the header size
+    headerSize = 0x18 + (blocksNumber * sizeof(uint32_t));
+
+    // Set the header input size and block size
+    fileHeader.uncompressedSize = uncompressedSize;
+    fileHeader.blockSize = options.blockSize;
+    fileHeader.indexShift = layoutShift != INDEX_SHIFT_WORST_CASE ? layoutShift : get_index_shift(uncompressedSize, options.blockSize, options.sectorLayout);
+    spdlog::debug("Index shift: {}.", fileHeader.indexShift);
+
+    // The header, the index and the final padding use a fixed space
+    if (targetWritten)
+    {
+        uint64_t reservedSize = headerSize + (1ULL << fileHeader.indexShift) - 1 + (options.hdlFix ? 2047 : 0);
+        targetDataSize = options.targetSize > reservedSize ? options.targetSize - reservedSize : 0;
+    }
+
+    spdlog::debug("Writing the file header.");
+    if (!output->write(0, reinterpret_cast<const char *>(&fileHeader), sizeof(fileHeader)))
+    {
+        spdlog::error("There was an error writing the output file.");
+        return false;
+    }
+
+    // Reserve the blocks index space
+    spdlog::debug("Reserving the blocks index.");
+    blocks.assign(blocksNumber, 0);
+
+    spdlog::debug("Writing the blocks index into the output file.");
+    if (!output->write(sizeof(fileHeader), (const char *)blocks.data(), blocksNumber * sizeof(uint32_t)))
+    {
+        spdlog::error("There was an error writing the output file.");
+        return false;
+    }
+    outputPosition = headerSize;
+
+    // Chunk size. To make it easier to manage, the data is compressed in chunks of a multiple of the blockSize.
+    // The input is read and the output is written by dedicated threads, so every buffer is doubled to allow the
+    // compressor to work with one while the other is being read or written. The compressed blocks are stored into
+    // slots of blockSize bytes before being written in order. The read buffers and the slots use 3/4 of the cache,
+    // and the write buffers the whole cache, to keep the memory usage below two times the cache size.
+    chunkSize = (options.cacheSize / 4) - ((options.cacheSize / 4) % options.blockSize);
+    if (chunkSize < options.blockSize)
+    {
+        chunkSize = options.blockSize;
+    }
+    spdlog::debug("The chunk size will be {}.", chunkSize);
+    if (uncompressedSize < chunkSize)
+    {
+        chunkSize = (blocksNumber - 1) * options.blockSize;
+        spdlog::debug("The input data is smaller than the chunk, so it will be adjusted to {} bytes.", chunkSize);
+    }
+    spdlog::debug("Reserving the compressed blocks slots space.");
+    slotsBuffer.assign(chunkSize, 0);
+
+    // Write buffer. The output block size is not fixed, so cannot be calculated and we will use the cache size.
+    uint32_t writeBufferSize = options.cacheSize / 2;
+    if (writeBufferSize < options.blockSize * 4)
+    {
+        writeBufferSize = options.blockSize * 4;
+    }
+    spdlog::debug("Reserving the write buffers space.");
+    writeBuffers[0].assign(writeBufferSize, 0);
+    writeBuffers[1].assign(writeBufferSize, 0);
+
+    spdlog::debug("Starting {} compression threads.", options.threads);
+    compressor = std::make_unique<compression_pool>(options, chunkSize / options.blockSize);
+    writer = std::make_unique<io_thread>();
+
+    return true;
+}
+
+bool ziso_encoder::add(const char *src, uint64_t srcSize)
+{
+    if (srcSize > fileHeader.uncompressedSize - inputPosition - pendingSize)
+    {
+        spdlog::error("The added data is bigger than the uncompressed size.");
+        return false;
+    }
+
+    while (srcSize > 0)
+    {
+        // Full chunks and the last chunk are compressed directly from the source data
+        if (pendingSize == 0 && (srcSize >= chunkSize || inputPosition + srcSize == fileHeader.uncompressedSize))
+        {
+            uint32_t directSize = srcSize < chunkSize ? srcSize : chunkSize;
+            if (!compress_chunk(src, directSize))
+            {
+                return false;
+            }
+            src += directSize;
+            srcSize -= directSize;
+            continue;
+        }
+
+        // The rest is stored until a chunk is completed
+        if (pendingBuffer.size() < chunkSize)
+        {
+            pendingBuffer.resize(chunkSize, 0);
+        }
+        uint32_t toCopy = chunkSize - pendingSize;
+        if (toCopy > srcSize)
+        {
+            toCopy = srcSize;
+        }
+        std::memcpy(pendingBuffer.data() + pendingSize, src, toCopy);
+        pendingSize += toCopy;
+        src += toCopy;
+        srcSize -= toCopy;
+
+        if (pendingSize == chunkSize)
+        {
+            if (!compress_chunk(pendingBuffer.data(), pendingSize))
+            {
+                return false;
+            }
+            pendingSize = 0;
+        }
+    }
+
+    return true;
+}
+
+bool ziso_encoder::finish()
+{
+    // Compress the last partial chunk
+    if (pendingSize)
+    {
+        if (!compress_chunk(pendingBuffer.data(), pendingSize))
+        {
+            return false;
+        }
+        pendingSize = 0;
+    }
+
+    if (inputPosition != fileHeader.uncompressedSize)
+    {
+        spdlog::error("The compressed data size doesn't matches the uncompressed size. {} vs {}", inputPosition, fileHeader.uncompressedSize);
+        return false;
+    }
+
+    // Align the file and set the eof position block
+    spdlog::trace("Aligning the last block from: {}...", outputPosition + writeBufferPos);
+    if (!write_padding(fileHeader.indexShift))
+    {
+        return false;
+    }
+    blocks[blocksNumber - 1] = (outputPosition >> fileHeader.indexShift);
+    spdlog::trace("Aligned block position: {}...", outputPosition);
+
+    // The HDL_dump bug trims the data at the end of the file if doesn't fit into a 2048 multiple.
+    // This fix will pad the output file to the nearest 2048 bytes multiple.
+    if (options.hdlFix)
+    {
+        spdlog::trace("Aplying the HDL fix to avoid the files to be truncated on copy");
+        if (!write_padding(11))
+        {
+            return false;
+        }
+    }
+
+    // Write the blocks index
+    spdlog::trace("Writting the index data (overwrite)");
+    if (!output->write(0x18, (const char *)blocks.data(), blocksNumber * sizeof(uint32_t)))
+    {
+        spdlog::error("There was an error writing the output file.");
+        return false;
+    }
+    spdlog::trace("Writen {} bytes at {} position", blocksNumber * sizeof(uint32_t), 0x18);
+
+    return true;
+}
+
+bool ziso_encoder::encode(ziso_input &input, ziso_output &output)
+{
+    uint64_t inputSize = input.size();
+    if (options.targetSize && !plan_target_size(input, inputSize))
+    {
+        return false;
+    }
+
+    // The tiers can change the options and the summary while compressing, so they are restored if the output is
+    // compressed again
+    ziso_options startOptions = options;
+    summary startTierSummary = tierSummary;
+    if (!options.targetSize && (options.maxTime || options.minThroughput > 0))
+    {
+        build_tiers();
+        startTierSummary = tierSummary;
+    }
+    else if (!options.targetSize)
+    {
+        tiers.clear();
+    }
+    timeStart = std::chrono::steady_clock::now();
+    encoding = true;
+    uint8_t worstCaseShift = get_index_shift(inputSize, options.blockSize, options.sectorLayout);
+    layoutShift = estimate_index_shift(input, inputSize);
+    layoutRestarts = 0;
+    // End of the data written by the passes which didn't fit the index
+    uint64_t discardedEnd = 0;
+
+    while (true)
+    {
+        if (!begin(output, inputSize))
+        {
+            layoutShift = INDEX_SHIFT_WORST_CASE;
+            encoding = false;
+            return false;
+        }
+
+        // The output can prepare the write buffers to speed up the writes
+        output.register_buffer(writeBuffers[0].data(), writeBuffers[0].size());
+        output.register_buffer(writeBuffers[1].data(), writeBuffers[1].size());
+
+        bool compressed;
+        // The data of the mapped inputs is compressed directly from the memory, without copying it into the read buffers
+        if (const char *data = input.get_data(0, inputSize))
+        {
+            spdlog::debug("The input is in memory, so it will be compressed directly.");
+            compressed = add(data, inputSize);
+        }
+        else
+        {
+            compressed = compress_input(input, inputSize);
+        }
+        compressed = compressed && finish();
+
+        // The buffers cannot be unregistered while they are being written
+        writer->wait();
+        output.unregister_buffer(writeBuffers[0].data());
+        output.unregister_buffer(writeBuffers[1].data());
+
+        if (compressed || !layoutOverflow || layoutShift >= worstCaseShift)
+        {
+            if (layoutOverflow && layoutShift >= worstCaseShift)
+            {
+                spdlog::error("The compressed output doesn't fit the index at the shift {}.", layoutShift);
+            }
+            // A new pass uses the remaining time and a bigger alignment, so its output is almost always bigger, but
+            // the tiers of the time limits and the target size can still select a better compression in some chunks.
+            // The data written after the end of the new output is removed.
+            if (compressed && discardedEnd > outputPosition && !output.truncate(outputPosition))
+            {
+                spdlog::error("There was an error truncating the output file.");
+                compressed = false;
+            }
+            // The streaming methods always use the worst case shift, and start the time in begin
+            layoutShift = INDEX_SHIFT_WORST_CASE;
+            encoding = false;
+            return compressed;
+        }
+
+        discardedEnd = std::max(discardedEnd, outputPosition);
+        spdlog::debug("The output doesn't fit the index shift {}, so it will be compressed again.", layoutShift);
+        layoutShift++;
+        layoutRestarts++;
+        // The options and the tiers summary start again, but the time limits keep the start time and the measured
+        // throughputs, so the new pass only uses the remaining time
+        options = startOptions;
+        tierSummary = startTierSummary;
+        targetPredicted = 0;
+    }
+}
+
+bool ziso_encoder::encode(const ziso_options &options, const char *src, uint64_t srcSize, std::vector<char> &dst)
+{
+    ziso_encoder encoder(options);
+    memory_input input(src, srcSize);
+    memory_output output;
+
+    if (!encoder.encode(input, output))
+    {
+        return false;
+    }
+    // Release the writer thread before getting the data
+    encoder.writer.reset();
+
+    dst = std::move(output.get_data());
+    return true;
+}
+
+bool ziso_encoder::compress_input(ziso_input &input, uint64_t inputSize)
+{
+    spdlog::debug("Reserving the read buffers space.");
+    std::vector<char> readBuffers[2] = {std::vector<char>(chunkSize, 0), std::vector<char>(chunkSize, 0)};
+    uint8_t currentReadBuffer = 0;
+    bool readFailed = false;
+    io_thread reader;
+    input.register_buffer(readBuffers[0].data(), readBuffers[0].size());
+    input.register_buffer(readBuffers[1].data(), readBuffers[1].size());
+
+    // Start reading the first chunk
+    uint64_t readPosition = 0;
+    uint32_t readBytes = 0;
+    auto read_chunk = [&](std::vector<char> &buffer)
+    {
+        readBytes = chunkSize;
+        if (readBytes > inputSize - readPosition)
+        {
+            readBytes = inputSize - readPosition;
+        }
+        spdlog::trace("{} bytes will be read from input file", readBytes);
+        reader.run([&input, &buffer, &readFailed, position = readPosition, size = readBytes]
+                   {
+                       if (!input.read(position, buffer.data(), size))
+                       {
+                           readFailed = true;
+                       } });
+        readPosition += readBytes;
+    };
+    read_chunk(readBuffers[currentReadBuffer]);
+
+    bool compressed = true;
+    while (compressed && inputPosition < inputSize)
+    {
+        // Wait for the current chunk
+        reader.wait();
+        if (readFailed)
+        {
+            spdlog::error("There was an error reading the input file.");
+            compressed = false;
+            break;
+        }
+        const char *chunk = readBuffers[currentReadBuffer].data();
+        uint32_t chunkBytes = readBytes;
+
+        // Prefetch the next chunk while the current one is compressed
+        currentReadBuffer ^= 1;
+        if (readPosition < inputSize)
+        {
+            read_chunk(readBuffers[currentReadBuffer]);
+        }
+
+        compressed = compress_chunk(chunk, chunkBytes);
+    }
+
+    // The buffers cannot be unregistered while they are being read
+    reader.wait();
+    input.unregister_buffer(readBuffers[0].data());
+    input.unregister_buffer(readBuffers[1].data());
+
+    return compressed;
+}
+
+void ziso_encoder::build_tiers()
+{
+    // The tiers are sorted by cost: the LZ4 levels, LZ4HC only in the promising blocks, and LZ4HC in every block
+    if (options.alternativeLz4 || options.bruteForce || options.exhaustive || options.lz4hc || options.twoTier)
+    {
+        spdlog::debug("The compression tiers replace the LZ4 Mode 2, brute-force, exhaustive, LZ4HC and two-tier options.");
+    }
+    tiers.clear();
+    ziso_options tierOptions = options;
+    tierOptions.alternativeLz4 = false;
+    tierOptions.bruteForce = false;
+    tierOptions.exhaustive = false;
+    tierOptions.lz4hc = false;
+    tierOptions.twoTier = false;
+    for (uint8_t level = 1; level <= 12; level++)
+    {
+        tierOptions.compressionLevel = level;
+        tiers.push_back({tierOptions, {0}, 0, 0});
+    }
+    tierOptions.lz4hc = true;
+    tierOptions.twoTier = true;
+    for (uint8_t level : {4, 9, 12})
+    {
+        tierOptions.compressionLevel = level;
+        tiers.push_back({tierOptions, {0}, 0, 0});
+    }
+    tierOptions.twoTier = false;
+    tiers.push_back({tierOptions, {0}, 0, 0});
+
+    currentTier = 0;
+    tierSummary = summary();
+}
+
+void ziso_encoder::apply_tier(size_t tier)
+{
+    // The options are only changed between chunks, when the compression threads don't use them
+    const ziso_options &tierOptions = tiers[tier].options;
+    options.lz4hc = tierOptions.lz4hc;
+    options.twoTier = tierOptions.twoTier;
+    options.compressionLevel = tierOptions.compressionLevel;
+
+    if (tier != currentTier)
+    {
+        tierSummary.tierChanges++;
+        currentTier = tier;
+    }
+    if (!tierOptions.lz4hc)
+    {
+        tierSummary.tierLz4Chunks++;
+    }
+    else if (tierOptions.twoTier)
+    {
+        tierSummary.tierTwoTierChunks++;
+    }
+    else
+    {
+        tierSummary.tierHcChunks++;
+    }
+}
+
+bool ziso_encoder::plan_target_size(ziso_input &input, uint64_t inputSize)
+{
+    build_tiers();
+
+    // Compress some blocks spread over the input with every tier. The file map regions use the same compression in
+    // every tier, so they are compressed only once.
+    ziso_options hcOptions = tiers.back().options;
+    hcOptions.compressionLevel = ISO_HC_LEVEL;
+    compression_context context(tiers[0].options);
+    std::vector<char> block(options.blockSize, 0);
+    std::vector<char> compressed(options.blockSize, 0);
+    uint64_t blocksNumber = (inputSize + options.blockSize - 1) / options.blockSize;
+    // Every block is aligned to the index shift, which wastes half of the alignment on average, plus the average
+    // sector layout padding when the shift allows it
+    uint8_t indexShift = get_index_shift(inputSize, options.blockSize, options.sectorLayout);
+    uint32_t alignmentSize = ((1 << indexShift) - 1) / 2;
+    bool sectorPadding = SECTOR_LAYOUT_SIZE % (1 << indexShift) == 0;
+    targetSampleStep = std::max<uint64_t>(1, blocksNumber / TARGET_SAMPLE_BLOCKS);
+    targetSampledInput.assign(1, 0);
+
+    for (uint64_t sample = 0; sample < blocksNumber; sample += targetSampleStep)
+    {
+        uint64_t position = sample * options.blockSize;
+        uint32_t blockSize = std::min<uint64_t>(options.blockSize, inputSize - position);
+        if (!input.read(position, block.data(), blockSize))
+        {
+            spdlog::error("There was an error reading the input file.");
+            return false;
+        }
+        targetSampledInput.push_back(targetSampledInput.back() + blockSize);
+
+        uint8_t strategy = options.fileMap ? options.fileMap->get_strategy(position) : REGION_NORMAL;
+        bool uncompressed = false;
+        summary sampleSummary;
+        uint32_t regionSize = blockSize;
+        if (strategy == REGION_HC)
+        {
+            regionSize = compress_block(block.data(), blockSize, compressed.data(), compressed.size(), uncompressed, hcOptions, context, sampleSummary);
+        }
+        for (compression_tier &tier : tiers)
+        {
+            uint32_t sampleSize = strategy == REGION_NORMAL
+                                      ? compress_block(block.data(), blockSize, compressed.data(), compressed.size(), uncompressed, tier.options, context, sampleSummary)
+                                      : regionSize;
+            uint32_t paddingSize = sectorPadding ? std::lround(estimate_sector_padding(sampleSize)) : 0;
+            tier.sampledSizes.push_back(tier.sampledSizes.back() + sampleSize + alignmentSize + paddingSize);
+        }
+    }
+
+    // The header, the index and the final padding use a fixed space
+    uint64_t reservedSize = 0x18 + (blocksNumber + 1) * sizeof(uint32_t) + (1 << indexShift) - 1;
+    if (options.hdlFix)
+    {
+        reservedSize += 2047;
+    }
+    targetDataSize = options.targetSize > reservedSize ? options.targetSize - reservedSize : 0;
+    targetPredicted = 0;
+
+    size_t selected = tiers.size() - 1;
+    for (size_t tier = 0; tier < tiers.size(); tier++)
+    {
+        double estimated = estimate_target_size(tier, 0, inputSize);
+        spdlog::debug("Target tier {} (LZ4HC: {}, two-tier: {}, level: {}) estimated size: {:.0f}",
+                      tier, tiers[tier].options.lz4hc, tiers[tier].options.twoTier, tiers[tier].options.compressionLevel, estimated);
+        if (selected == tiers.size() - 1 && estimated <= targetDataSize)
+        {
+            selected = tier;
+        }
+    }
+    tierSummary.targetEstimated = estimate_target_size(selected, 0, inputSize) + reservedSize;
+    spdlog::debug("Target tier {} selected, with an estimated output of {} bytes.", selected, tierSummary.targetEstimated);
+    if (tierSummary.targetEstimated > options.targetSize)
+    {
+        spdlog::debug("The output is not expected to fit the target size even using the best compression.");
+    }
+
+    // The compression threads are created using the selected tier
+    options = tiers[selected].options;
+    currentTier = selected;
+    return true;
+}
+
+double ziso_encoder::estimate_target_size(size_t tier, uint64_t start, uint64_t end) const
+{
+    // The samples inside the range are scaled to the range size. If the range has no samples, the nearest are used.
+    size_t samples = targetSampledInput.size() - 1;
+    size_t first = std::min<uint64_t>(((start / options.blockSize) + targetSampleStep - 1) / targetSampleStep, samples);
+    size_t last = std::min<uint64_t>(((end / options.blockSize) + targetSampleStep - 1) / targetSampleStep, samples);
+    if (first == last)
+    {
+        first = first > 0 ? first - 1 : 0;
+        last = std::min(first + 1, samples);
+    }
+    if (first == last)
+    {
+        return end - start;
+    }
+
+    const std::vector<uint64_t> &sizes = tiers[tier].sampledSizes;
+    return (double)(sizes[last] - sizes[first]) * (end - start) / (targetSampledInput[last] - targetSampledInput[first]);
+}
+
+void ziso_encoder::select_target_tier(uint32_t srcSize)
+{
+    // The compressed chunks are used to correct the estimations, and the fastest tier which fits the remaining data
+    // into the remaining size is selected
+    double written = outputPosition + writeBufferPos - headerSize;
+    double remainingSize = targetDataSize > written ? (targetDataSize - written) * (1 - TARGET_SAFETY_MARGIN) : 0;
+    double correction = targetPredicted > 0 ? std::clamp(written / targetPredicted, TARGET_CORRECTION_MIN, TARGET_CORRECTION_MAX) : 1;
+
+    size_t tier = 0;
+    while (tier + 1 < tiers.size() &&
+           estimate_target_size(tier, inputPosition, fileHeader.uncompressedSize) * correction > remainingSize)
+    {
+        tier++;
+    }
+    spdlog::trace("Target tier {} selected for the chunk at {}.", tier, inputPosition);
+
+    apply_tier(tier);
+    targetPredicted += estimate_target_size(tier, inputPosition, inputPosition + srcSize);
+}
+
+void ziso_encoder::select_written_tier(uint32_t srcSize)
+{
+    // The ratio of the previous chunk, including the alignment and the padding, updates the ratio of its tier
+    uint64_t written = outputPosition + writeBufferPos;
+    if (chunkInput)
+    {
+        double measured = (double)(written - chunkOutput) / chunkInput;
+        double &ratio = tiers[currentTier].ratio;
+        ratio = ratio > 0 ? ratio * (1 - TARGET_RATIO_WEIGHT) + measured * TARGET_RATIO_WEIGHT : measured;
+    }
+    chunkOutput = written;
+    chunkInput = srcSize;
+
+    // Ratio required to fit the remaining input into the remaining size
+    double writtenData = written - headerSize;
+    double remainingSize = targetDataSize > writtenData ? (targetDataSize - writtenData) * (1 - TARGET_SAFETY_MARGIN) : 0;
+    double required = remainingSize / (fileHeader.uncompressedSize - inputPosition);
+
+    // The fastest measured tier which fits, or the next one which was not used yet
+    size_t tier = tiers.size() - 1;
+    for (size_t current = 0; current < tiers.size(); current++)
+    {
+        if (tiers[current].ratio == 0 || tiers[current].ratio <= required)
+        {
+            tier = current;
+            break;
+        }
+    }
+    spdlog::trace("Target tier {} selected for the chunk at {}. Required ratio: {:.4f}", tier, inputPosition, required);
+
+    apply_tier(tier);
+}
+
+void ziso_encoder::select_time_tier(uint32_t srcSize)
+{
+    // The throughput of the previous chunk includes the reads and writes, and updates the throughput of its tier
+    auto now = std::chrono::steady_clock::now();
+    if (chunkInput)
+    {
+        double chunkTime = std::chrono::duration<double>(now - chunkStart).count();
+        double measured = chunkInput / std::max(chunkTime, 1e-6);
+        double &throughput = tiers[currentTier].throughput;
+        throughput = throughput > 0 ? throughput * (1 - TIME_THROUGHPUT_WEIGHT) + measured * TIME_THROUGHPUT_WEIGHT : measured;
+    }
+    chunkStart = now;
+    chunkInput = srcSize;
+
+    // Throughput required to finish in time
+    double required = options.minThroughput * 1024 * 1024;
+    if (options.maxTime)
+    {
+        double remainingTime = options.maxTime - std::chrono::duration<double>(now - timeStart).count();
+        double remainingInput = fileHeader.uncompressedSize - inputPosition;
+        required = std::max(required, remainingTime > 0 ? remainingInput / remainingTime : HUGE_VAL);
+    }
+
+    // The best measured tier which is fast enough, or the next one if it was not used and there is time to try it
+    size_t tier = 0;
+    for (size_t current = 0; current < tiers.size(); current++)
+    {
+        if (tiers[current].throughput >= required * TIME_HEADROOM)
+        {
+            tier = current;
+        }
+    }
+    if (tier + 1 < tiers.size() && tiers[tier + 1].throughput == 0 && tiers[tier].throughput >= required * TIME_EXPLORE_HEADROOM)
+    {
+        tier++;
+    }
+    spdlog::trace("Time tier {} selected for the chunk at {}. Required throughput: {:.0f} bytes/s", tier, inputPosition, required);
+
+    apply_tier(tier);
+}
+
+uint8_t ziso_encoder::get_index_shift(uint64_t uncompressedSize, uint32_t blockSize, uint16_t sectorLayout)
+{
+    uint64_t blocksNumber = (uncompressedSize + blockSize - 1) / blockSize + 1;
+    uint64_t headerSize = 0x18 + (blocksNumber * sizeof(uint32_t));
+
+    // The blocks are never bigger than the uncompressed data, and every block (and the end of the file) can waste
+    // up to the alignment size minus one byte, plus the sector layout padding when the shift allows it. Bigger shift
+    // means more waste.
+    uint8_t indexShift = 0;
+    while (indexShift < 32)
+    {
+        uint64_t alignment = (1ULL << indexShift) - 1;
+        uint64_t padding = SECTOR_LAYOUT_SIZE % (1ULL << indexShift) == 0 ? get_sector_padding_max(sectorLayout) : 0;
+        uint64_t maxOutputSize = headerSize + uncompressedSize + (blocksNumber * (alignment + padding));
+        if (maxOutputSize <= (INDEX_POSITION_MAX << indexShift))
+        {
+            break;
+        }
+        indexShift++;
+    }
+
+    return indexShift;
+}
+
+double ziso_encoder::estimate_sector_padding(uint32_t compressedSize) const
+{
+    if (!options.sectorLayout)
+    {
+        return 0;
+    }
+
+    // A block straddles when it starts in the last bytes of a sector, and the padding is the distance to the next
+    // sector. With a uniform start offset, the average padding is the sum of the paddings up to the cost of a read
+    // divided by the sector size.
+    uint32_t tail = compressedSize % SECTOR_LAYOUT_SIZE;
+    uint64_t maxPadding = std::min<uint32_t>((tail ? tail : SECTOR_LAYOUT_SIZE) - 1, get_sector_read_cost(options.sectorLayout));
+    return (double)(maxPadding * (maxPadding + 1) / 2) / SECTOR_LAYOUT_SIZE;
+}
+
+uint8_t ziso_encoder::estimate_index_shift(ziso_input &input, uint64_t inputSize)
+{
+    uint8_t worstCaseShift = get_index_shift(inputSize, options.blockSize, options.sectorLayout);
+    if (worstCaseShift == 0)
+    {
+        return 0;
+    }
+
+    // Compress some blocks spread over the input to estimate the output size
+    compression_context context(options);
+    std::vector<char> block(options.blockSize, 0);
+    std::vector<char> compressed(options.blockSize, 0);
+    uint64_t blocksNumber = (inputSize + options.blockSize - 1) / options.blockSize;
+    uint64_t step = std::max<uint64_t>(1, blocksNumber / INDEX_SHIFT_SAMPLE_BLOCKS);
+    uint64_t sampledInput = 0;
+    uint64_t sampledOutput = 0;
+    double sampledPadding = 0;
+
+    for (uint64_t sample = 0; sample < blocksNumber; sample += step)
+    {
+        uint64_t position = sample * options.blockSize;
+        uint32_t blockSize = std::min<uint64_t>(options.blockSize, inputSize - position);
+        if (!input.read(position, block.data(), blockSize))
+        {
+            // The error will be found again while compressing
+            return worstCaseShift;
+        }
+
+        bool uncompressed = false;
+        summary sampleSummary;
+        uint32_t compressedSize = compress_block(block.data(), blockSize, compressed.data(), compressed.size(), uncompressed, options, context, sampleSummary);
+        sampledInput += blockSize;
+        sampledOutput += compressedSize;
+        sampledPadding += estimate_sector_padding(compressedSize);
+    }
+
+    // The smallest shift where the estimated output fits. The blocks waste half of the alignment on average, and the
+    // sector layout padding is only added when the sector start is aligned to the shift.
+    double estimatedSize = 0x18 + (blocksNumber + 1) * sizeof(uint32_t) + (double)sampledOutput * inputSize / sampledInput;
+    double estimatedPadding = sampledPadding * inputSize / sampledInput;
+    for (uint8_t indexShift = 0; indexShift < worstCaseShift; indexShift++)
+    {
+        uint64_t alignment = (1ULL << indexShift) - 1;
+        double padding = SECTOR_LAYOUT_SIZE % (1ULL << indexShift) == 0 ? estimatedPadding : 0;
+        if (estimatedSize + padding + (blocksNumber * alignment) / 2 + alignment <= (INDEX_POSITION_MAX << indexShift))
+        {
+            spdlog::debug("Estimated output size: {:.0f} bytes. Index shift {} selected instead of {}.", estimatedSize, indexShift, worstCaseShift);
+            return indexShift;
+        }
+    }
+
+    return worstCaseShift;
+}
+
+const zheader &ziso_encoder::get_header() const
+{
+    return fileHeader;
+}
+
+const std::vector<uint32_t> &ziso_encoder::get_blocks() const
+{
+    return blocks;
+}
+
+uint64_t ziso_encoder::get_output_size() const
+{
+    return outputPosition;
+}
+
+summary ziso_encoder::get_summary()
+{
+    if (!compressor)
+    {
+        return summary();
+    }
+    summary total = compressor->get_summary();
+    total += tierSummary;
+    total += layoutSummary;
+    total.indexShift = fileHeader.indexShift;
+    total.indexShiftWorstCase = get_index_shift(fileHeader.uncompressedSize, options.blockSize, options.sectorLayout);
+    total.layoutRestarts = layoutRestarts;
+    return total;
+}
+
+bool ziso_encoder::compress_chunk(const char *src, uint32_t srcSize)
+{
+    if (!tiers.empty() && options.targetSize && !targetSampledInput.empty())
+    {
+        select_target_tier(srcSize);
+    }
+    else if (!tiers.empty() && options.targetSize)
+    {
+        select_written_tier(srcSize);
+    }
+    else if (!tiers.empty())
+    {
+        select_time_tier(srcSize);
+    }
+    compressor->submit(src, srcSize, slotsBuffer.data(), currentBlock);
+
+    // Collect the compressed blocks in order. The blocks index and the output will be the same as compressing them serially.
+    uint32_t chunkBlocks = (srcSize + options.blockSize - 1) / options.blockSize;
+    for (uint32_t chunkBlock = 0; chunkBlock < chunkBlocks; chunkBlock++, currentBlock++)
+    {
+        spdlog::trace("Writing the block {}.", currentBlock + 1);
+        std::vector<char> &writeBuffer = writeBuffers[currentWriteBuffer];
+
+        bool uncompressed = false;
+        uint32_t compressedBytes = compressor->wait(chunkBlock, uncompressed);
+        spdlog::trace("CompressedBytes: {}", compressedBytes);
+
+        if (compressedBytes == 0)
+        {
+            spdlog::error("There was an error compressing the source file.");
+            // The workers must stop using the chunk before returning
+            compressor->wait_idle();
+            return false;
+        }
+
+        // Fill the output with zeroes until a valid start point depending of index shift
+        spdlog::trace("Aligning the output buffer to the nearest shifted position.");
+        uint16_t alignment = buffer_align(writeBuffer.data() + writeBufferPos, outputPosition + writeBufferPos, fileHeader.indexShift);
+        writeBufferPos += alignment;
+        spdlog::trace("The new aligned position is {}.", outputPosition + writeBufferPos);
+
+        if (options.sectorLayout)
+        {
+            // The padding also moves the next block, so its size is used when it's in the chunk
+            bool nextUncompressed = false;
+            uint32_t nextSize = chunkBlock + 1 < chunkBlocks ? compressor->wait(chunkBlock + 1, nextUncompressed) : 0;
+            writeBufferPos += sector_padding(writeBuffer.data() + writeBufferPos, outputPosition + writeBufferPos, compressedBytes, nextSize);
+        }
+
+        // Capture the block position
+        uint64_t blockStartPosition = outputPosition + writeBufferPos;
+        lastBlockPosition = blockStartPosition;
+
+        // The end of the block is the start of the next one, which must fit the index using the current shift
+        if (blockStartPosition + compressedBytes > (INDEX_POSITION_MAX << fileHeader.indexShift))
+        {
+            // The encode methods compress the input again with a bigger shift, or report the error if not possible
+            if (layoutShift == INDEX_SHIFT_WORST_CASE)
+            {
+                spdlog::error("The compressed output doesn't fit the index at the shift {}.", fileHeader.indexShift);
+            }
+            layoutOverflow = true;
+            compressor->wait_idle();
+            return false;
+        }
+
+        std::memcpy(writeBuffer.data() + writeBufferPos, slotsBuffer.data() + (chunkBlock * options.blockSize), compressedBytes);
+        writeBufferPos += compressedBytes;
+
+        spdlog::trace(
+            "Output Position: {} - Output Buffer Size: {} - Output Buffer Position: {} - Block Compressed Size: {}",
+            outputPosition,
+            writeBuffer.size(),
+            writeBufferPos,
+            compressedBytes);
+
+        // Keep room for the next block with its alignment and sector padding
+        if ((writeBuffer.size() - writeBufferPos) < (options.blockSize * 2) + (options.sectorLayout ? SECTOR_LAYOUT_SIZE : 0))
+        {
+            if (!flush_write_buffer())
+            {
+                compressor->wait_idle();
+                return false;
+            }
+        }
+
+        // Set the current block start point with the uncompressed flag
+        blocks[currentBlock] = (blockStartPosition >> fileHeader.indexShift) | ((uint32_t)uncompressed << 31);
+
+        // Update the progress
+        if (progress)
+        {
+            uint64_t currentInput = inputPosition + ((uint64_t)(chunkBlock + 1) * options.blockSize);
+            if (currentInput > inputPosition + srcSize)
+            {
+                currentInput = inputPosition + srcSize;
+            }
+            progress(currentInput, blockStartPosition - headerSize);
+        }
+    }
+
+    inputPosition += srcSize;
+    return true;
+}
+
+/**
+ * @brief Check if a block requires an extra device read because it crosses more sectors than its size
+ *
+ * @param position The block position
+ * @param size The block size
+ * @return true If the block crosses an extra sector
+ * @return false If the block uses the min sectors
+ */
+static bool crosses_extra_sector(uint64_t position, uint32_t size)
+{
+    uint64_t offset = position % SECTOR_LAYOUT_SIZE;
+    uint64_t sectors = (offset + size + SECTOR_LAYOUT_SIZE - 1) / SECTOR_LAYOUT_SIZE;
+    uint64_t minSectors = (size + SECTOR_LAYOUT_SIZE - 1) / SECTOR_LAYOUT_SIZE;
+    return sectors != minSectors;
+}
+
+uint32_t ziso_encoder::get_sector_read_cost(uint16_t sectorLayout)
+{
+    return sectorLayout == SECTOR_LAYOUT_MODEL ? SECTOR_LAYOUT_MODEL_COST : sectorLayout;
+}
+
+uint32_t ziso_encoder::get_sector_padding_max(uint16_t sectorLayout)
+{
+    // A padding can avoid the extra reads of the block and the next one
+    return std::min<uint32_t>(get_sector_read_cost(sectorLayout) * 2, SECTOR_LAYOUT_SIZE - 1);
+}
+
+uint32_t ziso_encoder::sector_padding(char *buffer, uint64_t position, uint32_t size, uint32_t nextSize)
+{
+    if (!crosses_extra_sector(position, size))
+    {
+        return 0;
+    }
+
+    // The padding moves the next block too, which can start or stop crossing an extra sector. The next block is
+    // aligned to the index shift, and it's not known at the end of the chunk, so then it's not counted.
+    uint32_t padding = SECTOR_LAYOUT_SIZE - (position % SECTOR_LAYOUT_SIZE);
+    int32_t avoidedReads = 1;
+    if (nextSize)
+    {
+        uint64_t alignment = (1ULL << fileHeader.indexShift) - 1;
+        uint64_t nextPosition = (position + size + alignment) & ~alignment;
+        uint64_t paddedNextPosition = (position + padding + size + alignment) & ~alignment;
+        avoidedReads += (int32_t)crosses_extra_sector(nextPosition, nextSize) - (int32_t)crosses_extra_sector(paddedNextPosition, nextSize);
+    }
+
+    // The padding is read at the read speed, so it must cost less than the avoided reads. It must also keep the sector
+    // start aligned to the index shift, and keep the previous block, which contains the padding, inside the max block
+    // size accepted by the readers.
+    if ((int64_t)padding > avoidedReads * (int64_t)get_sector_read_cost(options.sectorLayout) ||
+        SECTOR_LAYOUT_SIZE % (1 << fileHeader.indexShift) != 0 ||
+        (currentBlock > 0 && position + padding - lastBlockPosition > (uint64_t)options.blockSize * 2))
+    {
+        layoutSummary.sectorStraddles++;
+        return 0;
+    }
+
+    spdlog::trace("Adding {} bytes of padding to start the block {} in a new sector.", padding, currentBlock + 1);
+    std::memset(buffer, 0, padding);
+    layoutSummary.sectorStraddlesAvoided++;
+    layoutSummary.sectorPadding += padding;
+    return padding;
+}
+
+bool ziso_encoder::flush_write_buffer()
+{
+    // Wait until the previous buffer is written and send the current one to the writer thread
+    spdlog::trace("Flushing write buffer...");
+    writer->wait();
+    if (writeFailed)
+    {
+        spdlog::error("There was an error writing the output file.");
+        return false;
+    }
+
+    if (writeBufferPos)
+    {
+        writer->run([this, &writeBuffer = writeBuffers[currentWriteBuffer], position = outputPosition, size = writeBufferPos]
+                    {
+                        if (!output->write(position, writeBuffer.data(), size))
+                        {
+                            writeFailed = true;
+                        } });
+        outputPosition += writeBufferPos;
+        writeBufferPos = 0;
+        currentWriteBuffer ^= 1;
+    }
+
+    return true;
+}
+
+bool ziso_encoder::write_padding(uint8_t shift)
+{
+    writeBufferPos += buffer_align(writeBuffers[currentWriteBuffer].data() + writeBufferPos, outputPosition + writeBufferPos, shift);
+
+    // Write all the pending data
+    if (!flush_write_buffer())
+    {
+        return false;
+    }
+    writer->wait();
+    if (writeFailed)
+    {
+        spdlog::error("There was an error writing the output file.");
+        return false;
+    }
+
+    return true;
+}
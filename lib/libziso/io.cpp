@@ -0,0 +1,1114 @@
+#include "libziso/io.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+
+#include <fcntl.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+// Max size of every read/write call. Some systems fail with very big requests.
+constexpr uint64_t IO_MAX_REQUEST = 0x40000000;
+// Size of the memory pages of the system cache
+constexpr uint64_t IO_PAGE_SIZE = 4096;
+
+memory_input::memory_input(const char *data, uint64_t dataSize)
+    : data(data),
+      dataSize(dataSize)
+{
+}
+
+uint64_t memory_input::size()
+{
+    return dataSize;
+}
+
+bool memory_input::read(uint64_t position, char *dst, uint64_t size)
+{
+    if (position > dataSize || size > (dataSize - position))
+    {
+        return false;
+    }
+
+    std::memcpy(dst, data + position, size);
+    return true;
+}
+
+const char *memory_input::get_data(uint64_t position, uint64_t size)
+{
+    if (position > dataSize || size > (dataSize - position))
+    {
+        return nullptr;
+    }
+
+    return data + position;
+}
+
+mmap_input::~mmap_input()
+{
+    close();
+}
+
+bool mmap_input::open(const std::string &filename)
+{
+    close();
+
+#if defined(_WIN32)
+    (void)filename;
+    return false;
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat))
+    {
+        ::close(fd);
+        return false;
+    }
+    dataSize = fileStat.st_size;
+
+    // Empty files cannot be mapped
+    if (dataSize)
+    {
+        void *mapped = mmap(nullptr, dataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            ::close(fd);
+            dataSize = 0;
+            return false;
+        }
+        data = (char *)mapped;
+        madvise(data, dataSize, MADV_SEQUENTIAL);
+    }
+
+    // The mapping keeps the file open
+    ::close(fd);
+    return true;
+#endif
+}
+
+uint64_t mmap_input::size()
+{
+    return dataSize;
+}
+
+bool mmap_input::read(uint64_t position, char *dst, uint64_t size)
+{
+    if (position > dataSize || size > (dataSize - position))
+    {
+        return false;
+    }
+
+    std::memcpy(dst, data + position, size);
+    return true;
+}
+
+const char *mmap_input::get_data(uint64_t position, uint64_t size)
+{
+    if (data == nullptr || position > dataSize || size > (dataSize - position))
+    {
+        return nullptr;
+    }
+
+    return data + position;
+}
+
+void mmap_input::close()
+{
+#if !defined(_WIN32)
+    if (data)
+    {
+        munmap(data, dataSize);
+    }
+#endif
+    data = nullptr;
+    dataSize = 0;
+}
+
+bool memory_output::write(uint64_t position, const char *src, uint64_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (data.size() < position + size)
+    {
+        data.resize(position + size, 0);
+    }
+
+    std::memcpy(data.data() + position, src, size);
+    return true;
+}
+
+bool memory_output::truncate(uint64_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (data.size() > size)
+    {
+        data.resize(size);
+    }
+    return true;
+}
+
+std::vector<char> &memory_output::get_data()
+{
+    return data;
+}
+
+fd_input::fd_input(int fd)
+    : fd(fd)
+{
+}
+
+uint64_t fd_input::size()
+{
+#if defined(_WIN32)
+    return _filelengthi64(fd);
+#else
+    struct stat fileStat;
+    if (fstat(fd, &fileStat))
+    {
+        return 0;
+    }
+    return fileStat.st_size;
+#endif
+}
+
+bool fd_input::read(uint64_t position, char *dst, uint64_t size)
+{
+    [[maybe_unused]] uint64_t initialSize = size;
+#if defined(_WIN32)
+    std::lock_guard<std::mutex> lock(mutex);
+    if (_lseeki64(fd, position, SEEK_SET) < 0)
+    {
+        return false;
+    }
+#endif
+
+    while (size > 0)
+    {
+        uint64_t toRead = size < IO_MAX_REQUEST ? size : IO_MAX_REQUEST;
+#if defined(_WIN32)
+        int readBytes = _read(fd, dst, toRead);
+#else
+        ssize_t readBytes = pread(fd, dst, toRead, position);
+#endif
+        if (readBytes <= 0)
+        {
+            // Error or end of file
+            return false;
+        }
+
+        dst += readBytes;
+        position += readBytes;
+        size -= readBytes;
+    }
+
+#if defined(__linux__)
+    if (dropCache)
+    {
+        // Only the full pages are removed, so the page shared with the previous read is also included
+        uint64_t start = (position - initialSize) & ~(uint64_t)(IO_PAGE_SIZE - 1);
+        posix_fadvise(fd, start, position - start, POSIX_FADV_DONTNEED);
+    }
+#endif
+
+    return true;
+}
+
+void fd_input::set_drop_cache(bool dropCache)
+{
+    this->dropCache = dropCache;
+#if defined(__linux__)
+    posix_fadvise(fd, 0, 0, dropCache ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+#endif
+}
+
+fd_output::fd_output(int fd)
+    : fd(fd)
+{
+}
+
+bool fd_output::write(uint64_t position, const char *src, uint64_t size)
+{
+    uint64_t initialSize = size;
+#if defined(_WIN32)
+    std::lock_guard<std::mutex> lock(mutex);
+    if (_lseeki64(fd, position, SEEK_SET) < 0)
+    {
+        return false;
+    }
+#endif
+
+    while (size > 0)
+    {
+        uint64_t toWrite = size < IO_MAX_REQUEST ? size : IO_MAX_REQUEST;
+#if defined(_WIN32)
+        int writtenBytes = _write(fd, src, toWrite);
+#else
+        ssize_t writtenBytes = pwrite(fd, src, toWrite, position);
+#endif
+        if (writtenBytes <= 0)
+        {
+            return false;
+        }
+
+        src += writtenBytes;
+        position += writtenBytes;
+        size -= writtenBytes;
+    }
+
+    if (writebackSize)
+    {
+        writeback(position - initialSize, initialSize);
+    }
+
+    return true;
+}
+
+bool fd_output::truncate(uint64_t size)
+{
+#if defined(_WIN32)
+    return _chsize_s(fd, size) == 0;
+#else
+    return ftruncate(fd, size) == 0;
+#endif
+}
+
+void fd_output::set_writeback(uint64_t writebackSize)
+{
+    this->writebackSize = writebackSize;
+}
+
+void fd_output::writeback(uint64_t position, uint64_t size)
+{
+#if defined(__linux__)
+    std::lock_guard<std::mutex> lock(writebackMutex);
+
+    // Consecutive writes are merged in a single range
+    if (!pendingRanges.empty() && pendingRanges.back().position + pendingRanges.back().size == position)
+    {
+        pendingRanges.back().size += size;
+    }
+    else
+    {
+        pendingRanges.push_back({position, size});
+    }
+    pendingSize += size;
+
+    if (pendingSize < writebackSize)
+    {
+        return;
+    }
+
+    // Wait for the previous writeback and remove its data from the system cache
+    for (auto &range : flushingRanges)
+    {
+        sync_file_range(fd, range.position, range.size, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, range.position, range.size, POSIX_FADV_DONTNEED);
+    }
+    flushingRanges.clear();
+
+    // Start the writeback of the pending data without waiting for it
+    for (auto &range : pendingRanges)
+    {
+        sync_file_range(fd, range.position, range.size, SYNC_FILE_RANGE_WRITE);
+    }
+    flushingRanges.swap(pendingRanges);
+    pendingSize = 0;
+#else
+    (void)position;
+    (void)size;
+#endif
+}
+
+file_input::file_input()
+    : fd_input(-1)
+{
+}
+
+file_input::~file_input()
+{
+    close();
+}
+
+bool file_input::open(const std::string &filename)
+{
+    close();
+#if defined(_WIN32)
+    fd = _open(filename.c_str(), _O_RDONLY | _O_BINARY);
+#else
+    fd = ::open(filename.c_str(), O_RDONLY);
+#endif
+    return fd >= 0;
+}
+
+void file_input::close()
+{
+    if (fd >= 0)
+    {
+#if defined(_WIN32)
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+        fd = -1;
+    }
+}
+
+file_output::file_output()
+    : fd_output(-1)
+{
+}
+
+file_output::~file_output()
+{
+    close();
+}
+
+bool file_output::open(const std::string &filename)
+{
+    close();
+#if defined(_WIN32)
+    fd = _open(filename.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    return fd >= 0;
+}
+
+void file_output::close()
+{
+    if (fd >= 0)
+    {
+#if defined(_WIN32)
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+        fd = -1;
+    }
+}
+
+direct_file_input::direct_file_input(uint32_t bufferSize)
+{
+    // The buffer must have space for the data plus the unaligned start
+    this->bufferSize = ((bufferSize + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT + 1) * DIRECT_IO_ALIGNMENT;
+}
+
+direct_file_input::~direct_file_input()
+{
+    close();
+}
+
+bool direct_file_input::open(const std::string &filename)
+{
+    close();
+
+#if defined(O_DIRECT)
+    if (posix_memalign((void **)&buffer, DIRECT_IO_ALIGNMENT, bufferSize))
+    {
+        buffer = nullptr;
+        return false;
+    }
+
+    fd = ::open(filename.c_str(), O_RDONLY | O_DIRECT);
+    if (fd < 0)
+    {
+        close();
+        return false;
+    }
+
+    return true;
+#else
+    (void)filename;
+    return false;
+#endif
+}
+
+void direct_file_input::close()
+{
+#if defined(O_DIRECT)
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    free(buffer);
+    buffer = nullptr;
+#endif
+}
+
+uint64_t direct_file_input::size()
+{
+#if defined(O_DIRECT)
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat))
+    {
+        return 0;
+    }
+    return fileStat.st_size;
+#else
+    return 0;
+#endif
+}
+
+bool direct_file_input::read(uint64_t position, char *dst, uint64_t size)
+{
+#if defined(O_DIRECT)
+    std::lock_guard<std::mutex> lock(mutex);
+    while (size > 0)
+    {
+        // Read the aligned sectors which contains the data
+        uint64_t alignedPosition = position - (position % DIRECT_IO_ALIGNMENT);
+        uint32_t offset = position - alignedPosition;
+        uint64_t toRead = ((offset + size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT) * DIRECT_IO_ALIGNMENT;
+        if (toRead > bufferSize)
+        {
+            toRead = bufferSize;
+        }
+
+        // The read will be shorter at the end of the file
+        ssize_t readBytes = pread(fd, buffer, toRead, alignedPosition);
+        if (readBytes <= (ssize_t)offset)
+        {
+            // Error or end of file
+            return false;
+        }
+
+        uint64_t toCopy = readBytes - offset;
+        if (toCopy > size)
+        {
+            toCopy = size;
+        }
+        std::memcpy(dst, buffer + offset, toCopy);
+
+        dst += toCopy;
+        position += toCopy;
+        size -= toCopy;
+    }
+
+    return true;
+#else
+    (void)position;
+    (void)dst;
+    (void)size;
+    return false;
+#endif
+}
+
+direct_file_output::direct_file_output(uint32_t bufferSize)
+{
+    // The buffer must have space for the data plus the unaligned start
+    this->bufferSize = ((bufferSize + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT + 1) * DIRECT_IO_ALIGNMENT;
+}
+
+direct_file_output::~direct_file_output()
+{
+    close();
+}
+
+bool direct_file_output::open(const std::string &filename)
+{
+    close();
+
+#if defined(O_DIRECT)
+    if (posix_memalign((void **)&buffer, DIRECT_IO_ALIGNMENT, bufferSize))
+    {
+        buffer = nullptr;
+        return false;
+    }
+
+    // The file is also read to merge the unaligned writes
+    fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0)
+    {
+        close();
+        return false;
+    }
+    dataSize = 0;
+    fileSize = 0;
+
+    return true;
+#else
+    (void)filename;
+    return false;
+#endif
+}
+
+bool direct_file_output::close()
+{
+    bool closed = true;
+#if defined(O_DIRECT)
+    if (fd >= 0)
+    {
+        // Remove the padding of the last sector
+        if (fileSize != dataSize && ftruncate(fd, dataSize))
+        {
+            closed = false;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+    free(buffer);
+    buffer = nullptr;
+#endif
+    return closed;
+}
+
+bool direct_file_output::write(uint64_t position, const char *src, uint64_t size)
+{
+#if defined(O_DIRECT)
+    std::lock_guard<std::mutex> lock(mutex);
+    while (size > 0)
+    {
+        uint64_t alignedPosition = position - (position % DIRECT_IO_ALIGNMENT);
+        uint32_t offset = position - alignedPosition;
+        uint64_t toWrite = size;
+        if (toWrite > bufferSize - offset)
+        {
+            toWrite = bufferSize - offset;
+        }
+        uint64_t alignedEnd = ((position + toWrite + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT) * DIRECT_IO_ALIGNMENT;
+        uint64_t lastSector = alignedEnd - DIRECT_IO_ALIGNMENT;
+
+        // Merge the data with the current content of the edge sectors
+        if (offset && !read_sector(alignedPosition, buffer))
+        {
+            return false;
+        }
+        if (((position + toWrite) % DIRECT_IO_ALIGNMENT) &&
+            (lastSector != alignedPosition || offset == 0) &&
+            !read_sector(lastSector, buffer + (lastSector - alignedPosition)))
+        {
+            return false;
+        }
+        std::memcpy(buffer + offset, src, toWrite);
+
+        uint64_t written = 0;
+        while (written < alignedEnd - alignedPosition)
+        {
+            ssize_t writtenBytes = pwrite(fd, buffer + written, (alignedEnd - alignedPosition) - written, alignedPosition + written);
+            if (writtenBytes <= 0)
+            {
+                return false;
+            }
+            written += writtenBytes;
+        }
+
+        fileSize = std::max(fileSize, alignedEnd);
+        dataSize = std::max(dataSize, position + toWrite);
+
+        src += toWrite;
+        position += toWrite;
+        size -= toWrite;
+    }
+
+    return true;
+#else
+    (void)position;
+    (void)src;
+    (void)size;
+    return false;
+#endif
+}
+
+bool direct_file_output::truncate(uint64_t size)
+{
+#if defined(O_DIRECT)
+    // The file is adjusted to the data size when closed
+    std::lock_guard<std::mutex> lock(mutex);
+    dataSize = std::min(dataSize, size);
+    return true;
+#else
+    (void)size;
+    return false;
+#endif
+}
+
+bool direct_file_output::read_sector(uint64_t position, char *dst)
+{
+#if defined(O_DIRECT)
+    // The sectors beyond the end of the file are empty
+    if (position >= fileSize)
+    {
+        std::memset(dst, 0, DIRECT_IO_ALIGNMENT);
+        return true;
+    }
+
+    return pread(fd, dst, DIRECT_IO_ALIGNMENT, position) == DIRECT_IO_ALIGNMENT;
+#else
+    (void)position;
+    (void)dst;
+    return false;
+#endif
+}
+
+#if defined(__linux__)
+/**
+ * @brief The io_uring submission and completion queues, which are shared with the kernel
+ *
+ */
+struct uring_file::uring_queue
+{
+    int ringFd = -1;
+    io_uring_params params = {};
+
+    void *sqRing = nullptr;
+    size_t sqRingSize = 0;
+    void *cqRing = nullptr;
+    size_t cqRingSize = 0;
+    io_uring_sqe *sqes = nullptr;
+
+    unsigned *sqTail = nullptr;
+    unsigned *sqMask = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned *cqMask = nullptr;
+    io_uring_cqe *cqes = nullptr;
+
+    ~uring_queue()
+    {
+        if (sqes)
+        {
+            munmap(sqes, params.sq_entries * sizeof(io_uring_sqe));
+        }
+        if (cqRing && cqRing != sqRing)
+        {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqRing)
+        {
+            munmap(sqRing, sqRingSize);
+        }
+        if (ringFd >= 0)
+        {
+            ::close(ringFd);
+        }
+    }
+
+    bool setup(uint32_t entries)
+    {
+        ringFd = syscall(__NR_io_uring_setup, entries, &params);
+        if (ringFd < 0)
+        {
+            return false;
+        }
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        // Newer kernels allow to map both rings at once
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED)
+        {
+            sqRing = nullptr;
+            return false;
+        }
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            cqRing = sqRing;
+        }
+        else
+        {
+            cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+            if (cqRing == MAP_FAILED)
+            {
+                cqRing = nullptr;
+                return false;
+            }
+        }
+        void *sqesMap = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (sqesMap == MAP_FAILED)
+        {
+            return false;
+        }
+        sqes = (io_uring_sqe *)sqesMap;
+
+        char *sq = (char *)sqRing;
+        sqTail = (unsigned *)(sq + params.sq_off.tail);
+        sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned *)(sq + params.sq_off.array);
+        char *cq = (char *)cqRing;
+        cqHead = (unsigned *)(cq + params.cq_off.head);
+        cqTail = (unsigned *)(cq + params.cq_off.tail);
+        cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+
+        return true;
+    }
+
+    int enter(unsigned toSubmit, unsigned minComplete)
+    {
+        return syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0);
+    }
+};
+
+/**
+ * @brief A read or write splitted into requests. The completions are processed by any of the threads which use the
+ * queue, so every request points to its transfer.
+ *
+ */
+struct uring_file::uring_transfer
+{
+    struct request
+    {
+        uint64_t position;
+        char *buffer;
+        uint32_t size;
+        uring_transfer *transfer;
+    };
+
+    std::vector<request> requests;
+    std::deque<request *> pending;
+    uint32_t inFlight = 0;
+    bool failed = false;
+};
+#else
+struct uring_file::uring_queue
+{
+};
+struct uring_file::uring_transfer
+{
+};
+#endif
+
+uring_file::uring_file(uint32_t queueDepth)
+    : queueDepth(queueDepth ? queueDepth : 1)
+{
+}
+
+uring_file::~uring_file()
+{
+    close();
+}
+
+bool uring_file::open(const std::string &filename, bool writeMode)
+{
+    close();
+
+#if defined(__linux__)
+    fd = ::open(filename.c_str(), writeMode ? O_WRONLY : O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    queue = std::make_unique<uring_queue>();
+    if (!queue->setup(queueDepth))
+    {
+        close();
+        return false;
+    }
+    // The kernel can round the queue size
+    queueDepth = queue->params.sq_entries;
+
+    return true;
+#else
+    (void)filename;
+    (void)writeMode;
+    return false;
+#endif
+}
+
+uint64_t uring_file::size()
+{
+#if defined(__linux__)
+    struct stat fileStat;
+    if (fd < 0 || fstat(fd, &fileStat))
+    {
+        return 0;
+    }
+    return fileStat.st_size;
+#else
+    return 0;
+#endif
+}
+
+bool uring_file::read(uint64_t position, char *dst, uint64_t size)
+{
+    return transfer(false, position, dst, size);
+}
+
+bool uring_file::write(uint64_t position, const char *src, uint64_t size)
+{
+    return transfer(true, position, (char *)src, size);
+}
+
+bool uring_file::truncate(uint64_t size)
+{
+#if defined(__linux__)
+    return fd >= 0 && ftruncate(fd, size) == 0;
+#else
+    (void)size;
+    return false;
+#endif
+}
+
+void uring_file::register_buffer(char *buffer, uint64_t size)
+{
+    // The requests in flight use the current buffer indexes, so they must finish before changing them
+    std::unique_lock<std::mutex> lock(mutex);
+    registering++;
+    completed.wait(lock, [this]
+                   { return inFlight == 0 || broken; });
+    buffers.emplace_back(buffer, size);
+    update_registered_buffers();
+    registering--;
+    lock.unlock();
+    completed.notify_all();
+}
+
+void uring_file::unregister_buffer(char *buffer)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    registering++;
+    completed.wait(lock, [this]
+                   { return inFlight == 0 || broken; });
+    std::erase_if(buffers, [buffer](const std::pair<char *, uint64_t> &registered)
+                  { return registered.first == buffer; });
+    update_registered_buffers();
+    registering--;
+    lock.unlock();
+    completed.notify_all();
+}
+
+bool uring_file::transfer(bool writeMode, uint64_t position, char *buffer, uint64_t size)
+{
+#if defined(__linux__)
+    if (!queue)
+    {
+        return false;
+    }
+
+    // Split the transfer into requests. The incomplete requests will be sent again with the pending data.
+    uring_transfer current;
+    current.requests.reserve((size + URING_SEGMENT_SIZE - 1) / URING_SEGMENT_SIZE);
+    for (uint64_t offset = 0; offset < size; offset += URING_SEGMENT_SIZE)
+    {
+        uint32_t requestSize = std::min<uint64_t>(URING_SEGMENT_SIZE, size - offset);
+        current.requests.push_back({position + offset, buffer + offset, requestSize, &current});
+    }
+    for (auto &request : current.requests)
+    {
+        current.pending.push_back(&request);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while ((!current.pending.empty() && !current.failed) || current.inFlight)
+    {
+        if (broken)
+        {
+            // The state of the submitted requests is unknown, so it's not safe to continue
+            return false;
+        }
+
+        submit_requests(current, writeMode);
+        if (broken)
+        {
+            completed.notify_all();
+            return false;
+        }
+
+        // Only one thread waits in the kernel, and it processes the completions of every transfer. The other ones
+        // wait until their requests are completed or the queue has room for them.
+        if (reaping || inFlight == 0)
+        {
+            completed.wait(lock);
+            continue;
+        }
+
+        reaping = true;
+        lock.unlock();
+        int waited = queue->enter(0, 1);
+        int waitError = errno;
+        lock.lock();
+        reaping = false;
+
+        if (waited < 0 && waitError != EINTR)
+        {
+            broken = true;
+        }
+        reap_completions();
+        completed.notify_all();
+    }
+
+    return !current.failed;
+#else
+    (void)writeMode;
+    (void)position;
+    (void)buffer;
+    (void)size;
+    return false;
+#endif
+}
+
+void uring_file::submit_requests(uring_transfer &current, bool writeMode)
+{
+#if defined(__linux__)
+    // Fill the submission queue while it has room. The buffers cannot be used while they are being registered.
+    unsigned tail = std::atomic_ref<unsigned>(*queue->sqTail).load(std::memory_order_relaxed);
+    while (!current.pending.empty() && !current.failed && !registering && inFlight < queueDepth)
+    {
+        uring_transfer::request *request = current.pending.front();
+        unsigned index = tail & *queue->sqMask;
+        io_uring_sqe &sqe = queue->sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        // The data inside a registered buffer is transferred with the fixed operations
+        if (int bufferIndex = get_buffer_index(request->buffer, request->size);
+            bufferIndex >= 0)
+        {
+            sqe.opcode = writeMode ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe.buf_index = bufferIndex;
+        }
+        else
+        {
+            sqe.opcode = writeMode ? IORING_OP_WRITE : IORING_OP_READ;
+        }
+        sqe.fd = fd;
+        sqe.off = request->position;
+        sqe.addr = (uint64_t)request->buffer;
+        sqe.len = request->size;
+        sqe.user_data = (uint64_t)request;
+        queue->sqArray[index] = index;
+
+        current.pending.pop_front();
+        tail++;
+        unsubmitted++;
+        inFlight++;
+        current.inFlight++;
+    }
+    std::atomic_ref<unsigned>(*queue->sqTail).store(tail, std::memory_order_release);
+
+    // The requests which were not accepted by the kernel will be submitted in the next call
+    if (unsubmitted)
+    {
+        if (int submitted = queue->enter(unsubmitted, 0);
+            submitted >= 0)
+        {
+            unsubmitted -= submitted;
+        }
+        else if (errno != EINTR)
+        {
+            broken = true;
+        }
+    }
+#else
+    (void)current;
+    (void)writeMode;
+#endif
+}
+
+void uring_file::reap_completions()
+{
+#if defined(__linux__)
+    unsigned head = std::atomic_ref<unsigned>(*queue->cqHead).load(std::memory_order_relaxed);
+    while (head != std::atomic_ref<unsigned>(*queue->cqTail).load(std::memory_order_acquire))
+    {
+        io_uring_cqe &cqe = queue->cqes[head & *queue->cqMask];
+        uring_transfer::request &request = *(uring_transfer::request *)cqe.user_data;
+        uring_transfer &owner = *request.transfer;
+        inFlight--;
+        owner.inFlight--;
+
+        if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+        {
+            owner.pending.push_back(&request);
+        }
+        else if (cqe.res <= 0)
+        {
+            // Error or end of file
+            owner.failed = true;
+        }
+        else if ((uint32_t)cqe.res < request.size)
+        {
+            // Partial transfer
+            request.position += cqe.res;
+            request.buffer += cqe.res;
+            request.size -= cqe.res;
+            owner.pending.push_back(&request);
+        }
+        head++;
+    }
+    std::atomic_ref<unsigned>(*queue->cqHead).store(head, std::memory_order_release);
+#endif
+}
+
+int uring_file::get_buffer_index(const char *buffer, uint32_t size) const
+{
+    if (buffersRegistered)
+    {
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            if (buffer >= buffers[i].first && buffer + size <= buffers[i].first + buffers[i].second)
+            {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+void uring_file::update_registered_buffers()
+{
+#if defined(__linux__)
+    if (!queue)
+    {
+        return;
+    }
+
+    if (buffersRegistered)
+    {
+        syscall(__NR_io_uring_register, queue->ringFd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+        buffersRegistered = false;
+    }
+    if (buffers.empty())
+    {
+        return;
+    }
+
+    std::vector<iovec> iovecs;
+    for (auto &[buffer, size] : buffers)
+    {
+        iovecs.push_back({buffer, size});
+    }
+    // If the buffers cannot be registered (for example because of the locked memory limit), the standard
+    // requests will be used
+    buffersRegistered = syscall(__NR_io_uring_register, queue->ringFd, IORING_REGISTER_BUFFERS, iovecs.data(), iovecs.size()) == 0;
+#endif
+}
+
+void uring_file::close()
+{
+#if defined(__linux__)
+    // Closing the queue releases the registered buffers
+    queue.reset();
+    buffersRegistered = false;
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include "libziso/iso.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <unordered_set>
+
+#include "spdlog/spdlog.h"
+
+// Files which are already compressed or are filled with random data
+static const std::vector<std::string> raw_extensions = {"PSS", "XA", "STR", "AT3", "PMF", "MPG", "M2V"};
+// Executables and uncompressed archives, which are usually used at startup or when loading levels
+static const std::vector<std::string> hc_extensions = {"ELF", "IRX", "PRX", "AFS", "PAK", "ARC"};
+
+static uint32_t read_le32(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint16_t read_le16(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+bool iso_file_map::load(ziso_input &input)
+{
+    regions.clear();
+    files = 0;
+    std::fill(std::begin(sizes), std::end(sizes), 0);
+
+    // Search the primary volume descriptor, which starts at the sector 16
+    std::vector<uint8_t> sector(ISO_SECTOR_SIZE, 0);
+    bool found = false;
+    for (uint32_t current = 16; current < 16 + 32 && !found; current++)
+    {
+        if (!input.read((uint64_t)current * ISO_SECTOR_SIZE, (char *)sector.data(), ISO_SECTOR_SIZE) ||
+            std::memcmp(sector.data() + 1, "CD001", 5) != 0 ||
+            sector[0] == 255)
+        {
+            break;
+        }
+        found = sector[0] == 1;
+    }
+    if (!found)
+    {
+        spdlog::debug("The ISO9660 primary volume descriptor was not found.");
+        return false;
+    }
+
+    if (read_le16(sector.data() + 128) != ISO_SECTOR_SIZE)
+    {
+        spdlog::debug("The ISO9660 filesystem doesn't use sectors of {} bytes.", ISO_SECTOR_SIZE);
+        return false;
+    }
+
+    // The root directory record is stored in the volume descriptor
+    uint64_t inputSize = input.size();
+    std::vector<std::pair<uint32_t, uint32_t>> pendingDirectories = {{read_le32(sector.data() + 156 + 2), read_le32(sector.data() + 156 + 10)}};
+    std::unordered_set<uint32_t> visitedDirectories;
+    std::vector<uint8_t> directory;
+
+    while (!pendingDirectories.empty())
+    {
+        auto [extent, extentSize] = pendingDirectories.back();
+        pendingDirectories.pop_back();
+
+        if (!visitedDirectories.insert(extent).second)
+        {
+            continue;
+        }
+        if (visitedDirectories.size() > ISO_MAX_DIRECTORIES ||
+            extentSize > ISO_MAX_DIRECTORY_SIZE ||
+            (uint64_t)extent * ISO_SECTOR_SIZE + extentSize > inputSize)
+        {
+            spdlog::debug("The ISO9660 directories are corrupted.");
+            return false;
+        }
+
+        directory.resize(extentSize);
+        if (!input.read((uint64_t)extent * ISO_SECTOR_SIZE, (char *)directory.data(), extentSize))
+        {
+            return false;
+        }
+
+        uint32_t position = 0;
+        while (position < extentSize)
+        {
+            uint8_t recordSize = directory[position];
+            if (recordSize == 0)
+            {
+                // The records don't cross the sectors, so the rest of the sector is empty
+                position = (position / ISO_SECTOR_SIZE + 1) * ISO_SECTOR_SIZE;
+                continue;
+            }
+            if (recordSize < 34 || position + recordSize > extentSize || 33 + directory[position + 32] > recordSize)
+            {
+                spdlog::debug("The ISO9660 directories are corrupted.");
+                return false;
+            }
+
+            const uint8_t *record = directory.data() + position;
+            position += recordSize;
+
+            uint32_t recordExtent = read_le32(record + 2);
+            uint32_t fileSize = read_le32(record + 10);
+            uint8_t flags = record[25];
+            std::string name((const char *)record + 33, record[32]);
+
+            // The current and parent directories
+            if (name.size() == 1 && (name[0] == 0 || name[0] == 1))
+            {
+                continue;
+            }
+
+            if (flags & 0x02)
+            {
+                pendingDirectories.push_back({recordExtent, fileSize});
+                continue;
+            }
+
+            // The files bigger than 4GB are stored in several extents with their own record
+            files++;
+            uint8_t strategy = get_file_strategy(name);
+            sizes[strategy] += fileSize;
+            if (strategy != REGION_NORMAL && fileSize > 0)
+            {
+                uint64_t start = (uint64_t)recordExtent * ISO_SECTOR_SIZE;
+                regions.push_back({start, start + fileSize, strategy});
+            }
+        }
+    }
+
+    std::sort(regions.begin(), regions.end(), [](const iso_region &a, const iso_region &b)
+              { return a.start < b.start; });
+
+    return true;
+}
+
+uint8_t iso_file_map::get_strategy(uint64_t position) const
+{
+    // The last region which starts before or at the position
+    auto region = std::upper_bound(regions.begin(), regions.end(), position, [](uint64_t value, const iso_region &current)
+                                   { return value < current.start; });
+    if (region == regions.begin())
+    {
+        return REGION_NORMAL;
+    }
+    region--;
+
+    return position < region->end ? region->strategy : REGION_NORMAL;
+}
+
+uint8_t iso_file_map::get_file_strategy(const std::string &filename)
+{
+    // Remove the version and convert to uppercase
+    std::string name = filename.substr(0, filename.find(';'));
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c)
+                   { return std::toupper(c); });
+
+    // The dummy files are used to move the data to the outer part of the disc, and are filled with random data or
+    // zeroes. The zero blocks are detected by the compressor, so only the random data is stored raw.
+    if (name.find("DUMMY") != std::string::npos)
+    {
+        return REGION_RAW;
+    }
+
+    // PS2 executables, like SLUS_123.45, and PSP executables
+    if ((name.size() == 11 && name[4] == '_' && name[8] == '.' && std::isalpha((unsigned char)name[0])) ||
+        name == "EBOOT.BIN" ||
+        name == "BOOT.BIN")
+    {
+        return REGION_HC;
+    }
+
+    size_t dot = name.find_last_of('.');
+    if (dot == std::string::npos)
+    {
+        return REGION_NORMAL;
+    }
+    std::string extension = name.substr(dot + 1);
+
+    if (std::find(raw_extensions.begin(), raw_extensions.end(), extension) != raw_extensions.end())
+    {
+        return REGION_RAW;
+    }
+    if (std::find(hc_extensions.begin(), hc_extensions.end(), extension) != hc_extensions.end())
+    {
+        return REGION_HC;
+    }
+
+    return REGION_NORMAL;
+}
+
+uint64_t iso_file_map::get_files() const
+{
+    return files;
+}
+
+uint64_t iso_file_map::get_size(uint8_t strategy) const
+{
+    return strategy < 3 ? sizes[strategy] : 0;
+}
\ No newline at end of file
@@ -0,0 +1,502 @@
+#include "libziso/reader.h"
+#include "libziso/compressor.h"
+#include <cstring>
+#include <thread>
+
+#include "spdlog/spdlog.h"
+
+zso_reader::zso_reader(uint32_t cacheBlocks, uint16_t cacheShards, uint32_t prefetchBlocks)
+    : cacheBlocks(cacheBlocks ? cacheBlocks : 1),
+      cacheShards(cacheShards ? cacheShards : 1),
+      prefetchBlocks(prefetchBlocks)
+{
+    // Every shard must have at least one entry
+    if (this->cacheShards > this->cacheBlocks)
+    {
+        this->cacheShards = this->cacheBlocks;
+    }
+    shardEntries = (this->cacheBlocks + this->cacheShards - 1) / this->cacheShards;
+}
+
+zso_reader::~zso_reader()
+{
+    stop_prefetch();
+}
+
+bool zso_reader::open(ziso_input &newInput, bool ignoreHeaderSize)
+{
+    // The prefetch thread must not use the old cache
+    stop_prefetch();
+
+    input = nullptr;
+    if (!index.open(newInput, ignoreHeaderSize))
+    {
+        return false;
+    }
+    input = &newInput;
+
+    const zheader &fileHeader = index.get_header();
+    uint32_t totalEntries = shardEntries * cacheShards;
+    cacheData.assign((uint64_t)totalEntries * fileHeader.blockSize, 0);
+    entries = std::make_unique<cache_entry[]>(totalEntries);
+    for (uint32_t i = 0; i < totalEntries; i++)
+    {
+        entries[i].data = cacheData.data() + ((uint64_t)i * fileHeader.blockSize);
+    }
+
+    shards = std::make_unique<cache_shard[]>(cacheShards);
+    for (uint16_t i = 0; i < cacheShards; i++)
+    {
+        shards[i].firstEntry = i * shardEntries;
+    }
+
+    uint32_t blocksNumber = index.get_blocks().size() - 1;
+    blockEntries = std::make_unique<std::atomic<uint32_t>[]>(blocksNumber);
+    for (uint32_t i = 0; i < blocksNumber; i++)
+    {
+        blockEntries[i].store(0, std::memory_order_relaxed);
+    }
+
+    return true;
+}
+
+uint64_t zso_reader::size()
+{
+    return input ? index.get_header().uncompressedSize : 0;
+}
+
+bool zso_reader::read(uint64_t position, char *dst, uint64_t size)
+{
+    const zheader &fileHeader = index.get_header();
+    if (!input || position > fileHeader.uncompressedSize || size > fileHeader.uncompressedSize - position)
+    {
+        return false;
+    }
+
+    while (size > 0)
+    {
+        uint32_t block = position / fileHeader.blockSize;
+        uint32_t blockOffset = position % fileHeader.blockSize;
+        uint64_t toCopy = fileHeader.blockSize - blockOffset;
+        if (toCopy > size)
+        {
+            toCopy = size;
+        }
+
+        // The block cannot be evicted while is pinned
+        cache_entry *entry = pin_block(block);
+        if (entry == nullptr)
+        {
+            return false;
+        }
+        std::memcpy(dst, entry->data + blockOffset, toCopy);
+        entry->state.fetch_sub(1, std::memory_order_release);
+
+        position += toCopy;
+        dst += toCopy;
+        size -= toCopy;
+    }
+
+    return true;
+}
+
+void zso_reader::prefetch(uint32_t firstBlock, uint32_t blocksCount)
+{
+    uint32_t blocksNumber = index.get_blocks().size() - 1;
+    if (!input || firstBlock >= blocksNumber || blocksCount == 0)
+    {
+        return;
+    }
+    if (blocksCount > blocksNumber - firstBlock)
+    {
+        blocksCount = blocksNumber - firstBlock;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        if (!prefetchThread.joinable())
+        {
+            prefetchStop = false;
+            prefetchThread = std::thread(&zso_reader::prefetch_loop, this);
+        }
+        // The old requests are less useful, because the reader has probably passed them
+        if (prefetchQueue.size() >= READER_PREFETCH_QUEUE_MAX)
+        {
+            prefetchQueue.pop_front();
+        }
+        prefetchQueue.emplace_back(firstBlock, blocksCount);
+    }
+    prefetchCondition.notify_one();
+}
+
+uint32_t zso_reader::get_prefetch_blocks() const
+{
+    return prefetchBlocks;
+}
+
+const zheader &zso_reader::get_header() const
+{
+    return index.get_header();
+}
+
+std::vector<reader_cache_stats> zso_reader::get_cache_stats() const
+{
+    std::vector<reader_cache_stats> stats(cacheShards);
+    if (shards)
+    {
+        for (uint16_t i = 0; i < cacheShards; i++)
+        {
+            stats[i].hits = shards[i].hits.load(std::memory_order_relaxed);
+            stats[i].misses = shards[i].misses.load(std::memory_order_relaxed);
+            stats[i].prefetched = shards[i].prefetched.load(std::memory_order_relaxed);
+        }
+    }
+    return stats;
+}
+
+zso_reader::cache_entry *zso_reader::try_pin(uint32_t block)
+{
+    uint32_t entryIndex = blockEntries[block].load(std::memory_order_acquire);
+    if (entryIndex == 0)
+    {
+        return nullptr;
+    }
+
+    // The entry can be evicted at any moment, so it is only pinned if it still contains the block
+    cache_entry &entry = entries[entryIndex - 1];
+    uint64_t state = entry.state.load(std::memory_order_acquire);
+    while ((state & ~ENTRY_PINS_MASK) == entry_state(block, ENTRY_READY))
+    {
+        if (entry.state.compare_exchange_weak(state, state + 1, std::memory_order_acquire))
+        {
+            // Avoid to write the shared flag if it's already set
+            if (!entry.referenced.load(std::memory_order_relaxed))
+            {
+                entry.referenced.store(true, std::memory_order_relaxed);
+            }
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
+zso_reader::cache_entry *zso_reader::pin_block(uint32_t block)
+{
+    cache_shard &shard = shards[block % cacheShards];
+
+    // Fast path: the block is in the cache, so the shard is not locked
+    if (cache_entry *entry = try_pin(block))
+    {
+        shard.hits.fetch_add(1, std::memory_order_relaxed);
+        return entry;
+    }
+
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    while (true)
+    {
+        if (uint32_t entryIndex = blockEntries[block].load(std::memory_order_acquire);
+            entryIndex)
+        {
+            cache_entry &entry = entries[entryIndex - 1];
+            uint64_t state = entry.state.load(std::memory_order_acquire);
+            if ((state & ~ENTRY_PINS_MASK) == entry_state(block, ENTRY_LOADING))
+            {
+                // Other thread is decompressing the block, so wait until it finishes
+                lock.unlock();
+                entry.state.wait(state, std::memory_order_acquire);
+                lock.lock();
+                continue;
+            }
+
+            // The block was loaded by other thread. It cannot be evicted while the shard is locked.
+            if (cache_entry *pinned = try_pin(block))
+            {
+                shard.hits.fetch_add(1, std::memory_order_relaxed);
+                return pinned;
+            }
+        }
+
+        // The block is not in the cache. Get a free entry, mark it as loading and decompress the block
+        // without locking the shard, so other blocks can be read meanwhile.
+        cache_entry *entry = claim_entry(shard, block);
+        if (entry == nullptr)
+        {
+            // All the entries are pinned, so try again later
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+            continue;
+        }
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+        lock.unlock();
+
+        // Several threads can decompress blocks at the same time, so every thread has its own read buffer
+        thread_local std::vector<char> readBuffer;
+        uint64_t blockStartPosition;
+        uint64_t blockEndPosition;
+        bool loaded = get_block_position(block, blockStartPosition, blockEndPosition);
+        if (loaded)
+        {
+            readBuffer.resize(blockEndPosition - blockStartPosition);
+            loaded = input->read(blockStartPosition, readBuffer.data(), readBuffer.size());
+            if (!loaded)
+            {
+                spdlog::error("There was an error reading the input file.");
+            }
+        }
+        loaded = loaded && decompress(block, readBuffer.data(), entry->data);
+
+        // The loader keeps the pin
+        release_entry(entry, block, loaded);
+        return loaded ? entry : nullptr;
+    }
+}
+
+zso_reader::cache_entry *zso_reader::claim_entry(cache_shard &shard, uint32_t block)
+{
+    cache_entry *entry = get_victim(shard, block);
+    if (entry)
+    {
+        blockEntries[block].store((entry - entries.get()) + 1, std::memory_order_release);
+    }
+    return entry;
+}
+
+void zso_reader::release_entry(cache_entry *entry, uint32_t block, bool loaded)
+{
+    if (loaded)
+    {
+        // Keep the loader pin, which will be released after reading the data
+        entry->state.store(entry_state(block, ENTRY_READY) | 1, std::memory_order_release);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(shards[block % cacheShards].mutex);
+        blockEntries[block].store(0, std::memory_order_relaxed);
+        entry->state.store(ENTRY_EMPTY, std::memory_order_release);
+    }
+    // Wake up the threads waiting for the block
+    entry->state.notify_all();
+}
+
+zso_reader::cache_entry *zso_reader::get_victim(cache_shard &shard, uint32_t block)
+{
+    // Two rounds to give a chance to the entries which lost the referenced flag in the first round
+    for (uint32_t i = 0; i < shardEntries * 2; i++)
+    {
+        cache_entry &entry = entries[shard.firstEntry + shard.clockHand];
+        shard.clockHand = (shard.clockHand + 1) % shardEntries;
+
+        uint64_t state = entry.state.load(std::memory_order_acquire);
+        if ((state & ENTRY_PINS_MASK) || (state & ENTRY_STATE_MASK) == ENTRY_LOADING)
+        {
+            continue;
+        }
+        if (entry.referenced.load(std::memory_order_relaxed))
+        {
+            entry.referenced.store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Fails if other thread pinned the entry meanwhile
+        if (entry.state.compare_exchange_strong(state, entry_state(block, ENTRY_LOADING) | 1, std::memory_order_acq_rel))
+        {
+            if ((state & ENTRY_STATE_MASK) == ENTRY_READY)
+            {
+                blockEntries[state >> 32].store(0, std::memory_order_relaxed);
+            }
+            entry.referenced.store(true, std::memory_order_relaxed);
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
+
+bool zso_reader::get_block_position(uint32_t block, uint64_t &startPosition, uint64_t &endPosition)
+{
+    const zheader &fileHeader = index.get_header();
+    const std::vector<uint32_t> &blocks = index.get_blocks();
+
+    startPosition = uint64_t(blocks[block] & 0x7FFFFFFF) << fileHeader.indexShift;
+    endPosition = uint64_t(blocks[block + 1] & 0x7FFFFFFF) << fileHeader.indexShift;
+
+    // The current block size cannot exceed 2 x blockSize.
+    if (endPosition < startPosition ||
+        (endPosition - startPosition) > (fileHeader.blockSize * 2))
+    {
+        spdlog::error("The input file header is corrupt. Corrupted index block.");
+        return false;
+    }
+
+    return true;
+}
+
+bool zso_reader::decompress(uint32_t block, const char *src, char *dst)
+{
+    const zheader &fileHeader = index.get_header();
+    const std::vector<uint32_t> &blocks = index.get_blocks();
+
+    bool uncompressed = blocks[block] & 0x80000000;
+    uint64_t blockStartPosition = uint64_t(blocks[block] & 0x7FFFFFFF) << fileHeader.indexShift;
+    uint64_t blockEndPosition = uint64_t(blocks[block + 1] & 0x7FFFFFFF) << fileHeader.indexShift;
+
+    // The last block can be smaller than the block size if the input size is not a block size multiple
+    uint32_t decompressedBlockSize = fileHeader.blockSize;
+    if (uint64_t leftInOutput = fileHeader.uncompressedSize - ((uint64_t)block * fileHeader.blockSize);
+        leftInOutput < decompressedBlockSize)
+    {
+        decompressedBlockSize = leftInOutput;
+    }
+
+    if (decompress_block(src, blockEndPosition - blockStartPosition, dst, decompressedBlockSize, uncompressed) != decompressedBlockSize)
+    {
+        spdlog::error("There was an error decompressing the block {}.", block);
+        return false;
+    }
+
+    return true;
+}
+
+void zso_reader::prefetch_loop()
+{
+    std::vector<char> readBuffer;
+    std::vector<std::pair<uint32_t, cache_entry *>> claimed;
+
+    while (true)
+    {
+        std::pair<uint32_t, uint32_t> request;
+        {
+            std::unique_lock<std::mutex> lock(prefetchMutex);
+            prefetchCondition.wait(lock, [this]
+                                   { return prefetchStop || !prefetchQueue.empty(); });
+            if (prefetchStop)
+            {
+                return;
+            }
+            request = prefetchQueue.front();
+            prefetchQueue.pop_front();
+        }
+
+        // Claim the blocks which are not in the cache. The readers will wait for them instead of decompressing them.
+        claimed.clear();
+        for (uint32_t block = request.first; block < request.first + request.second; block++)
+        {
+            cache_shard &shard = shards[block % cacheShards];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (blockEntries[block].load(std::memory_order_relaxed))
+            {
+                continue;
+            }
+            if (cache_entry *entry = claim_entry(shard, block))
+            {
+                shard.prefetched.fetch_add(1, std::memory_order_relaxed);
+                claimed.emplace_back(block, entry);
+            }
+        }
+        if (claimed.empty())
+        {
+            continue;
+        }
+
+        // The compressed blocks are stored contiguously, so the range between the first and the last claimed
+        // blocks is read at once.
+        uint64_t rangeStartPosition;
+        uint64_t rangeEndPosition;
+        uint64_t unused;
+        bool loaded = get_block_position(claimed.front().first, rangeStartPosition, unused) &&
+                      get_block_position(claimed.back().first, unused, rangeEndPosition);
+        if (loaded)
+        {
+            loaded = rangeEndPosition >= rangeStartPosition &&
+                     (rangeEndPosition - rangeStartPosition) <= (uint64_t)(claimed.back().first - claimed.front().first + 1) * index.get_header().blockSize * 2;
+        }
+        if (loaded)
+        {
+            readBuffer.resize(rangeEndPosition - rangeStartPosition);
+            loaded = input->read(rangeStartPosition, readBuffer.data(), readBuffer.size());
+        }
+
+        for (auto &[block, entry] : claimed)
+        {
+            uint64_t blockStartPosition;
+            uint64_t blockEndPosition;
+            bool blockLoaded = loaded &&
+                               get_block_position(block, blockStartPosition, blockEndPosition) &&
+                               blockStartPosition >= rangeStartPosition &&
+                               blockEndPosition <= rangeEndPosition &&
+                               decompress(block, readBuffer.data() + (blockStartPosition - rangeStartPosition), entry->data);
+
+            release_entry(entry, block, blockLoaded);
+            // The prefetcher doesn't keep the pin
+            if (blockLoaded)
+            {
+                entry->state.fetch_sub(1, std::memory_order_release);
+            }
+        }
+    }
+}
+
+void zso_reader::stop_prefetch()
+{
+    {
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        prefetchStop = true;
+        prefetchQueue.clear();
+    }
+    prefetchCondition.notify_all();
+
+    if (prefetchThread.joinable())
+    {
+        prefetchThread.join();
+    }
+}
+
+zso_reader_handle::zso_reader_handle(zso_reader &reader)
+    : reader(reader)
+{
+}
+
+uint64_t zso_reader_handle::size()
+{
+    return reader.size();
+}
+
+bool zso_reader_handle::read(uint64_t position, char *dst, uint64_t size)
+{
+    // A read is sequential if starts where the previous one ended
+    if (position == nextPosition && position != 0)
+    {
+        if (sequentialReads < READER_SEQUENTIAL_READS)
+        {
+            sequentialReads++;
+        }
+    }
+    else
+    {
+        sequentialReads = 0;
+        prefetchEnd = 0;
+    }
+    nextPosition = position + size;
+
+    if (!reader.read(position, dst, size))
+    {
+        return false;
+    }
+
+    // Request the next blocks when the half of the previous prefetched blocks were read
+    uint32_t prefetchBlocks = reader.get_prefetch_blocks();
+    if (sequentialReads >= READER_SEQUENTIAL_READS && prefetchBlocks && size)
+    {
+        uint32_t nextBlock = nextPosition / reader.get_header().blockSize;
+        if (prefetchEnd < nextBlock + (prefetchBlocks / 2) + 1)
+        {
+            uint32_t firstBlock = std::max(prefetchEnd, nextBlock);
+            reader.prefetch(firstBlock, nextBlock + prefetchBlocks - firstBlock);
+            prefetchEnd = nextBlock + prefetchBlocks;
+        }
+    }
+
+    return true;
+}
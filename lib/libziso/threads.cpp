@@ -0,0 +1,243 @@
+#include "threads.h"
+#include "libziso/compressor.h"
+#include "libziso/iso.h"
+
+compression_pool::compression_pool(const ziso_options &options, uint32_t maxBlocks)
+    : options(options),
+      hcOptions(options),
+      summaries(options.threads),
+      blockResults(new std::atomic<uint32_t>[maxBlocks])
+{
+    hcOptions.lz4hc = true;
+    hcOptions.bruteForce = false;
+    hcOptions.twoTier = false;
+    hcOptions.compressionLevel = ISO_HC_LEVEL;
+
+    if (options.duplicatesCacheSize)
+    {
+        duplicates = std::make_unique<duplicates_cache>(options.duplicatesCacheSize);
+    }
+
+    for (uint16_t i = 0; i < options.threads; i++)
+    {
+        contexts.push_back(std::make_unique<compression_context>(options));
+        contexts.back()->duplicates = duplicates.get();
+    }
+
+    // The calling thread is also a worker, so only the extra threads are created
+    for (uint16_t i = 1; i < options.threads; i++)
+    {
+        workers.emplace_back(&compression_pool::worker, this, i);
+    }
+}
+
+compression_pool::~compression_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    jobCondition.notify_all();
+
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void compression_pool::submit(const char *src, uint64_t srcSize, char *slots, uint64_t firstBlock)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    // Some workers can still be trying to get a block from the previous chunk
+    idleCondition.wait(lock, [this]
+                       { return activeWorkers == 0; });
+
+    jobSrc = src;
+    jobSrcSize = srcSize;
+    jobSlots = slots;
+    jobFirstBlock = firstBlock;
+    jobBlocks = (srcSize + options.blockSize - 1) / options.blockSize;
+    for (uint32_t i = 0; i < jobBlocks; i++)
+    {
+        blockResults[i].store(BLOCK_PENDING, std::memory_order_relaxed);
+    }
+    nextBlock.store(0, std::memory_order_relaxed);
+    jobId++;
+
+    lock.unlock();
+    jobCondition.notify_all();
+}
+
+uint32_t compression_pool::wait(uint32_t block, bool &uncompressed)
+{
+    uint32_t result;
+    while ((result = blockResults[block].load(std::memory_order_acquire)) == BLOCK_PENDING)
+    {
+        // Help the workers with the pending blocks, and sleep if all of them were already taken
+        if (!compress_next(0))
+        {
+            blockResults[block].wait(BLOCK_PENDING, std::memory_order_acquire);
+        }
+    }
+
+    uncompressed = result >> 31;
+    return result & 0x7FFFFFFF;
+}
+
+void compression_pool::wait_idle()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    // The pending blocks are not compressed by the calling thread, so they will not be used anymore
+    nextBlock.store(jobBlocks, std::memory_order_relaxed);
+    idleCondition.wait(lock, [this]
+                       { return activeWorkers == 0; });
+}
+
+summary compression_pool::get_summary()
+{
+    wait_idle();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    summary total;
+    for (auto &threadSummary : summaries)
+    {
+        total += threadSummary;
+    }
+    return total;
+}
+
+void compression_pool::worker(uint16_t thread)
+{
+    uint64_t lastJobId = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobCondition.wait(lock, [this, lastJobId]
+                              { return stop || jobId != lastJobId; });
+            if (stop)
+            {
+                return;
+            }
+            lastJobId = jobId;
+            activeWorkers++;
+        }
+
+        while (compress_next(thread))
+        {
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            activeWorkers--;
+        }
+        idleCondition.notify_all();
+    }
+}
+
+bool compression_pool::compress_next(uint16_t thread)
+{
+    uint32_t block = nextBlock.fetch_add(1, std::memory_order_relaxed);
+    if (block >= jobBlocks)
+    {
+        return false;
+    }
+
+    uint64_t blockStart = (uint64_t)block * options.blockSize;
+    uint32_t toRead = options.blockSize;
+    if (jobSrcSize - blockStart < toRead)
+    {
+        toRead = jobSrcSize - blockStart;
+    }
+
+    // The file map selects the compression of the regions with known files
+    uint8_t strategy = REGION_NORMAL;
+    if (options.fileMap)
+    {
+        strategy = options.fileMap->get_strategy((jobFirstBlock + block) * options.blockSize);
+    }
+
+    bool uncompressed = false;
+    uint32_t compressedBytes = 0;
+    // The dummy files can be filled with zeroes instead of random data, so the zero blocks of the raw regions are
+    // still copied from the compressed zero block
+    if (strategy == REGION_RAW && !is_zero_block(jobSrc + blockStart, toRead))
+    {
+        compressedBytes = store_block(jobSrc + blockStart, toRead, jobSlots + blockStart, options.blockSize, uncompressed, summaries[thread]);
+        summaries[thread].fileMapRaw++;
+    }
+    else
+    {
+        compressedBytes = compress_block(
+            jobSrc + blockStart,
+            toRead,
+            jobSlots + blockStart,
+            options.blockSize,
+            uncompressed,
+            strategy == REGION_HC ? hcOptions : options,
+            *contexts[thread],
+            summaries[thread]);
+        if (strategy == REGION_HC)
+        {
+            summaries[thread].fileMapHc++;
+        }
+    }
+
+    blockResults[block].store(compressedBytes | ((uint32_t)uncompressed << 31), std::memory_order_release);
+    blockResults[block].notify_all();
+    return true;
+}
+
+io_thread::io_thread()
+    : thread(&io_thread::loop, this)
+{
+}
+
+io_thread::~io_thread()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    condition.notify_all();
+    thread.join();
+}
+
+void io_thread::run(std::function<void()> newJob)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this]
+                   { return !job; });
+    job = std::move(newJob);
+    lock.unlock();
+    condition.notify_all();
+}
+
+void io_thread::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this]
+                   { return !job; });
+}
+
+void io_thread::loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        condition.wait(lock, [this]
+                       { return stop || job; });
+        // The pending job is always executed before stopping the thread
+        if (!job)
+        {
+            return;
+        }
+
+        lock.unlock();
+        job();
+        lock.lock();
+
+        job = nullptr;
+        condition.notify_all();
+    }
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "libziso/common.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+struct compression_context;
+class duplicates_cache;
+
+/**
+ * @brief Pool of worker threads used to compress the blocks of a chunk in parallel.
+ *
+ * Every block is compressed into its own slot of blockSize bytes, so the workers don't depend on the
+ * output position of the previous blocks. The caller collects the blocks in index order using the
+ * wait method, and helps compressing the pending blocks while waiting. With a single thread no
+ * workers are created and the caller compresses every block, just like the serial loop.
+ */
+class compression_pool
+{
+public:
+    compression_pool(const ziso_options &options, uint32_t maxBlocks);
+    ~compression_pool();
+
+    /**
+     * @brief Starts to compress the blocks of a new chunk. The previous chunk must be fully collected.
+     *
+     * @param src The chunk data
+     * @param srcSize The chunk data size. All the blocks will be full except maybe the last one.
+     * @param slots The output buffer. Must have space for maxBlocks * blockSize bytes.
+     * @param firstBlock The index of the chunk first block in the file, used to search the blocks in the file map
+     */
+    void submit(const char *src, uint64_t srcSize, char *slots, uint64_t firstBlock);
+
+    /**
+     * @brief Waits until a block of the current chunk is compressed
+     *
+     * @param block The block index inside the chunk
+     * @param uncompressed (output) True if the block was stored without compression
+     * @return uint32_t The compressed block size. Will return 0 if something was wrong.
+     */
+    uint32_t wait(uint32_t block, bool &uncompressed);
+
+    /**
+     * @brief Waits until the workers stop using the current chunk. Must be called before releasing the chunk
+     * buffers if not all the blocks were collected.
+     *
+     */
+    void wait_idle();
+
+    /**
+     * @brief Get the summary data of all the threads. Must be called when all the blocks were collected.
+     *
+     * @return summary The merged summary
+     */
+    summary get_summary();
+
+private:
+    void worker(uint16_t thread);
+    bool compress_next(uint16_t thread);
+
+    static constexpr uint32_t BLOCK_PENDING = 0xFFFFFFFF;
+
+    const ziso_options &options;
+    // Options used to compress the regions which use LZ4HC in the file map
+    ziso_options hcOptions;
+    std::vector<std::thread> workers;
+    std::vector<summary> summaries;
+    std::vector<std::unique_ptr<compression_context>> contexts;
+    std::unique_ptr<duplicates_cache> duplicates;
+
+    std::mutex mutex;
+    std::condition_variable jobCondition;
+    std::condition_variable idleCondition;
+    uint64_t jobId = 0;
+    uint16_t activeWorkers = 0;
+    bool stop = false;
+
+    // Current chunk
+    const char *jobSrc = nullptr;
+    uint64_t jobSrcSize = 0;
+    char *jobSlots = nullptr;
+    uint64_t jobFirstBlock = 0;
+    uint32_t jobBlocks = 0;
+    std::atomic<uint32_t> nextBlock = 0;
+    // Compressed size of every block with the uncompressed flag in the highest bit, or BLOCK_PENDING.
+    std::unique_ptr<std::atomic<uint32_t>[]> blockResults;
+};
+
+/**
+ * @brief Dedicated thread used to run the I/O operations in background, so the disk and the CPU can work at the same time.
+ *
+ * The jobs are executed one by one in the same order they were sent.
+ */
+class io_thread
+{
+public:
+    io_thread();
+    ~io_thread();
+
+    /**
+     * @brief Run a job in the thread. If the previous job is still running, waits until it finishes.
+     *
+     * @param newJob The job to run
+     */
+    void run(std::function<void()> newJob);
+
+    /**
+     * @brief Waits until the current job finishes
+     *
+     */
+    void wait();
+
+private:
+    void loop();
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::function<void()> job;
+    bool stop = false;
+    // Must be the last member to be started after the rest are initialized
+    std::thread thread;
+};
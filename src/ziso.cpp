@@ -1,6 +1,4 @@
 #include "ziso.h"
-#include "lz4.h"
-#include "lz4hc.h"
 #include "spdlog/sinks/basic_file_sink.h"
 
 // Arguments list
@@ -23,6 +21,24 @@ const std::vector<option> long_options = {
     {"log-file", required_argument, nullptr, 15},
     {"log-level", required_argument, nullptr, 16},
     {"ignore-header-size", no_argument, nullptr, 17},
+    {"threads", required_argument, nullptr, 18},
+    {"mmap", no_argument, nullptr, 19},
+    {"io-uring", no_argument, nullptr, 20},
+    {"direct-io", no_argument, nullptr, 21},
+    {"drop-cache", no_argument, nullptr, 22},
+    {"duplicates-cache", required_argument, nullptr, 23},
+    {"entropy-threshold", required_argument, nullptr, 24},
+    {"file-map", no_argument, nullptr, 25},
+    {"exhaustive", no_argument, nullptr, 26},
+    {"two-tier", no_argument, nullptr, 27},
+    {"min-saving", required_argument, nullptr, 28},
+    {"favor-decompression", no_argument, nullptr, 29},
+    {"target-size", required_argument, nullptr, 30},
+    {"max-time", required_argument, nullptr, 31},
+    {"min-throughput", required_argument, nullptr, 32},
+    {"sector-layout", required_argument, nullptr, 33},
+    {"two-tier-min", required_argument, nullptr, 34},
+    {"two-tier-max", required_argument, nullptr, 35},
     {nullptr, 0, nullptr, 0}};
 
 int main(int argc, char **argv)
@@ -36,24 +52,15 @@ int main(int argc, char **argv)
     // Main options
     opt options;
 
-    // Header
-    zheader fileHeader;
-
     // Other Variables
     uint64_t inputSize;
-    uint32_t blocksNumber;
-    uint32_t headerSize;
 
     // Progress
     uint8_t lastProgress = 100; // Force at 0% of progress
-    summary summaryData;
-
-    // Blocks data
-    std::vector<uint32_t> blocks;
 
     // Input and output files
-    std::fstream inFile;
-    std::fstream outFile;
+    file_input inFile;
+    file_output outFile;
 
     return_code = get_options(argc, argv, options);
     if (return_code)
@@ -61,6 +68,11 @@ int main(int argc, char **argv)
         goto exit;
     }
 
+    if (options.ioUring && options.directIo)
+    {
+        spdlog::warn("The io_uring interface doesn't use direct I/O. The direct I/O flag will be ignored...");
+    }
+
     spdlog::debug("Checking the input file.");
 
     if (options.inputFile.empty())
@@ -72,23 +84,18 @@ int main(int argc, char **argv)
     }
 
     // Open the input file
-    inFile.open(options.inputFile.c_str(), std::ios::in | std::ios::binary);
-    // Tricky way to check if was oppened correctly.
-    // The "is_open" method was failing on cross compiled EXE
+    if (!inFile.open(options.inputFile))
     {
-        char dummy;
-        if (!inFile.read(&dummy, 0))
-        {
-            spdlog::error("Input file cannot be opened.");
-            return_code = 1;
-            goto exit;
-        }
+        spdlog::error("Input file cannot be opened.");
+        return_code = 1;
+        goto exit;
     }
 
     // Check if the file is a ZISO File
     {
         std::vector<char> file_format(5, 0);
-        inFile.read(file_format.data(), 4);
+        // Files smaller than the magic will fail, and will be processed as ISO
+        inFile.read(0, file_format.data(), 4);
 
         if (
             file_format[0] == 'Z' &&
@@ -135,22 +142,18 @@ int main(int argc, char **argv)
     // Check if output file exists only if force_rewrite is false
     if (options.overwrite == false)
     {
-        char dummy;
-        outFile.open(options.outputFile.c_str(), std::ios::in | std::ios::binary);
-        if (outFile.read(&dummy, 0))
+        file_input outputCheck;
+        if (outputCheck.open(options.outputFile))
         {
             spdlog::error("Cowardly refusing to replace the output file. Use the -r/--replace options to force it.");
             options.keepOutput = true;
             return_code = 1;
             goto exit;
         }
-        outFile.close();
     }
 
     // Open the output file in replace mode
-    outFile.open(options.outputFile.c_str(), std::ios::out | std::ios::binary);
-    // Check if file was oppened correctly.
-    if (!outFile.good())
+    if (!outFile.open(options.outputFile))
     {
         spdlog::error("Output file cannot be opened.");
         return_code = 1;
@@ -171,9 +174,7 @@ int main(int argc, char **argv)
     {
         spdlog::info("Compressing the input file.");
         // Get the input size
-        inFile.seekg(0, std::ios_base::end);
-        inputSize = inFile.tellg();
-        inFile.seekg(0, std::ios_base::beg);
+        inputSize = inFile.size();
         spdlog::debug("The input file size is {} bytes.", inputSize);
 
         if (!options.blockSizeFixed)
@@ -190,49 +191,46 @@ int main(int argc, char **argv)
                 "please check if your OPL version is compatible.");
         }
 
-        // Get the total blocks
-        blocksNumber = ceil((float)inputSize / options.blockSize) + 1;
-        spdlog::debug("Number of blocks in file: {}.", blocksNumber - 1);
-        spdlog::debug("Last block size: {}. (0 means 'BlockSize')", inputSize % options.blockSize);
-        // Calculate the header size
-        headerSize = 0x18 + (blocksNumber * sizeof(uint32_t));
-
         spdlog::debug("Option blockSizeFixed: {}", options.blockSizeFixed);
         spdlog::debug("Option blockSize: {}", options.blockSize);
         spdlog::debug("Option compressionLevel: {}", options.compressionLevel);
         spdlog::debug("Option alternativeLz4: {}", options.alternativeLz4);
         spdlog::debug("Option bruteForce: {}", options.bruteForce);
+        spdlog::debug("Option exhaustive: {}", options.exhaustive);
+        spdlog::debug("Option twoTier: {}", options.twoTier);
+        spdlog::debug("Option twoTierMinRatio: {}", options.twoTierMinRatio);
+        spdlog::debug("Option twoTierMaxRatio: {}", options.twoTierMaxRatio);
+        spdlog::debug("Option minSaving: {}", options.minSaving);
+        spdlog::debug("Option favorDecompression: {}", options.favorDecompression);
+        spdlog::debug("Option targetSize: {}", options.targetSize);
+        spdlog::debug("Option maxTime: {}", options.maxTime);
+        spdlog::debug("Option minThroughput: {}", options.minThroughput);
+        spdlog::debug("Option sectorLayout: {}", options.sectorLayout);
         spdlog::debug("Option lz4hc: {}", options.lz4hc);
         spdlog::debug("Option hdlFix: {}", options.hdlFix);
-
-        // Set the header input size and block size
-        fileHeader.uncompressedSize = inputSize;
-        fileHeader.blockSize = options.blockSize;
-
-        // Set shift depending of the input size. Bigger shift means more waste.
-        if (inputSize > (uint64_t)(0x3FFFFFFFF - headerSize))
-        {
-            // Size is bigger than 17.179.869.183 (16GB-32GB). PS2 games aren't that big.
-            fileHeader.indexShift = 4;
-        }
-        if (inputSize > (uint64_t)(0x1FFFFFFFF - headerSize))
+        spdlog::debug("Option threads: {}", options.threads);
+        spdlog::debug("Option duplicatesCacheSize: {}", options.duplicatesCacheSize);
+        spdlog::debug("Option entropyThreshold: {}", options.entropyThreshold);
+        spdlog::debug("Option useFileMap: {}", options.useFileMap);
+        spdlog::debug("Option mmapInput: {}", options.mmapInput);
+        spdlog::debug("Option ioUring: {}", options.ioUring);
+        spdlog::debug("Option directIo: {}", options.directIo);
+        spdlog::debug("Option dropCache: {}", options.dropCache);
+
+        if (options.targetSize && (options.maxTime || options.minThroughput > 0))
         {
-            // Size is bigger than 8.589.934.591 (8GB-16GB)
-            fileHeader.indexShift = 3;
+            spdlog::warn("The target size will select the LZ4 and LZ4HC levels. The time limits will be ignored...");
         }
-        else if (inputSize > (0xFFFFFFFF - headerSize))
+        else if ((options.targetSize || options.maxTime || options.minThroughput > 0) &&
+                 (options.exhaustive || options.bruteForce || options.lz4hc || options.alternativeLz4))
         {
-            // Size is bigger than 4.294.967.295 (4GB-8GB)
-            fileHeader.indexShift = 2;
+            spdlog::warn("The target size and the time limits will select the LZ4 and LZ4HC levels. The exhaustive, brute-force, LZ4HC, LZ4 Mode 2 and compression level flags will be ignored...");
         }
-        else if (inputSize > (0x7FFFFFFF - headerSize))
+        else if (options.exhaustive && (options.bruteForce || options.lz4hc || options.alternativeLz4))
         {
-            // Size is bigger than 2.147.483.647 (2GB-4GB)
-            fileHeader.indexShift = 1;
+            spdlog::warn("The exhaustive search will try all the LZ4 and LZ4HC levels. The brute-force, LZ4HC and LZ4 Mode 2 flags will be ignored...");
         }
-        // Files with less than 2GB doesn't need to shift.
-
-        if (options.bruteForce && options.lz4hc)
+        else if (options.bruteForce && options.lz4hc)
         {
             spdlog::warn("The brute-force method will try the best between the two Standard LZ4 methods. LZ4HC already uses the best method, so no brute-force is required. LZ4HC flag will be ignored...");
         }
@@ -242,9 +240,29 @@ int main(int argc, char **argv)
         spdlog::info("{:<20s} {}", "Destination:", options.outputFile.c_str());
         spdlog::info("{:<20s} {} bytes", "Total File Size:", inputSize);
         spdlog::info("{:<20s} {}", "Block Size:", options.blockSize);
-        spdlog::info("{:<20s} {}", "Index align:", fileHeader.indexShift);
+        spdlog::info("{:<20s} {}", "Max Index align:", ziso_encoder::get_index_shift(inputSize, options.blockSize, options.sectorLayout));
         spdlog::info("{:<20s} {}", "Compress Level:", options.compressionLevel);
-        if (options.bruteForce)
+        spdlog::info("{:<20s} {}", "Threads:", options.threads);
+        if (options.targetSize)
+        {
+            spdlog::info("{:<20s} {} bytes", "Target Size:", options.targetSize);
+        }
+        else if (options.maxTime || options.minThroughput > 0)
+        {
+            if (options.maxTime)
+            {
+                spdlog::info("{:<20s} {}s", "Max Time:", options.maxTime);
+            }
+            if (options.minThroughput > 0)
+            {
+                spdlog::info("{:<20s} {}MB/s", "Min Throughput:", options.minThroughput);
+            }
+        }
+        else if (options.exhaustive)
+        {
+            spdlog::info("{:<20s} Yes", "Exhaustive Search:");
+        }
+        else if (options.bruteForce)
         {
             spdlog::info("{:20s} Yes", "Brute Force Search:");
         }
@@ -255,6 +273,14 @@ int main(int argc, char **argv)
         if (options.lz4hc)
         {
             spdlog::info("{:<20s} Yes", "LZ4 HC Compression:");
+            if (options.twoTier)
+            {
+                spdlog::info("{:<20s} Yes", "Two-tier:");
+            }
+            if (options.favorDecompression)
+            {
+                spdlog::info("{:<20s} Yes", "Favor Decompression:");
+            }
         }
         else
         {
@@ -270,318 +296,191 @@ int main(int argc, char **argv)
             spdlog::info("{:<20s} No", "LZ4 HC Compression:");
         }
 
-        spdlog::debug("Writing the file header.");
-        outFile.write(reinterpret_cast<const char *>(&fileHeader), sizeof(fileHeader));
-
-        // Reserve the blocks index space
-        spdlog::debug("Reserving the blocks index.");
-        blocks.resize(blocksNumber, 0);
-
-        spdlog::debug("Writing the blocks index into the output file.");
-        outFile.write((const char *)blocks.data(), blocksNumber * sizeof(uint32_t));
-
-        // Read buffer. To make it easier to manage, we will create a buffer with a size of a multiple of the blockSize.
-        uint32_t readBufferSize = options.cacheSize - (options.cacheSize % options.blockSize);
-        spdlog::debug("The read buffer size will be {}.", readBufferSize);
-        if (inputSize < readBufferSize)
+        mmap_input mappedInput;
+        ziso_input *input = &inFile;
+        if (options.mmapInput)
         {
-            readBufferSize = inputSize - (inputSize % options.blockSize);
-            spdlog::debug("The input file is smaller than the buffer, so buffer will be adjusted to {} bytes.", readBufferSize);
+            if (mappedInput.open(options.inputFile))
+            {
+                spdlog::debug("The input file was mapped into memory.");
+                input = &mappedInput;
+            }
+            else
+            {
+                spdlog::warn("The input file cannot be mapped into memory, so it will be read using the standard method.");
+            }
         }
-        uint32_t readBufferPos = readBufferSize; // Set the position to the End Of Buffer to force a fill at the first loop.
-        spdlog::debug("Reserving the read buffer space.");
-        std::vector<char> readBuffer(readBufferSize, 0);
-        // Write buffer. The output block size is not fixed, so cannot be calculated and we will use the cache size.
-        uint32_t writeBufferPos = 0;
-        spdlog::debug("Reserving the write buffer space.");
-        std::vector<char> writeBuffer(options.cacheSize, 0);
-
-        for (uint32_t currentBlock = 0; currentBlock < blocksNumber - 1; currentBlock++)
+        ziso_output *output = &outFile;
+        uring_file uringInput;
+        uring_file uringOutput;
+        if (options.ioUring)
         {
-            spdlog::trace("Compressing the block {}.", currentBlock + 1);
-
-            // If the current reader position is the end of the buffer, fill the buffer with new data
-            if (readBufferPos >= (readBufferSize - 1))
+            // The mapped input doesn't need to be read. Both files use the standard method if any of them fails.
+            if (uringOutput.open(options.outputFile, true) &&
+                (input != &inFile || uringInput.open(options.inputFile, false)))
             {
-                spdlog::trace("The read buffer is empty. Filling it with the input file data.");
-                uint32_t inputReadBytes = readBufferSize;
-                uint64_t leftInFile = inputSize - (uint64_t)inFile.tellg();
-                if (inputReadBytes > leftInFile)
+                if (input == &inFile)
                 {
-                    inputReadBytes = leftInFile;
+                    input = &uringInput;
                 }
-                spdlog::trace("{} bytes will be read from input file", inputReadBytes);
-                inFile.read(readBuffer.data(), inputReadBytes);
-                readBufferPos = 0;
+                output = &uringOutput;
             }
-
-            // Fill the output with zeroes until a valid start point depending of index shift
-            spdlog::trace("Aligning the output buffer to the nearest shifted position.");
-            uint16_t alignment = buffer_align(writeBuffer.data() + writeBufferPos, (uint64_t)outFile.tellp() + writeBufferPos, fileHeader.indexShift);
-            writeBufferPos += alignment;
-            spdlog::trace("The new aligned position is {}.", (uint64_t)outFile.tellp() + writeBufferPos);
-
-            // Capture the block position
-            uint64_t blockStartPosition = (uint64_t)outFile.tellp() + writeBufferPos;
-
-            uint64_t toRead = options.blockSize;
-            uint64_t leftInFile = inputSize - ((uint64_t)inFile.tellg() - ((readBufferSize - 1) - readBufferPos));
-            spdlog::trace(
-                "Input Size: {} - Input Position: {} - Read Buffer Size: {} - Read Buffer Position: {} - LeftInFile: {}",
-                inputSize,
-                (uint64_t)inFile.tellg(),
-                readBufferSize,
-                readBufferPos,
-                leftInFile);
-            if (leftInFile < toRead)
+            else
             {
-                toRead = leftInFile;
+                spdlog::warn("The io_uring interface is not available, so the files will be accessed using the standard method.");
             }
-            spdlog::trace("To Read: {}", toRead);
-
-            bool uncompressed = false;
-            int compressedBytes = compress_block(
-                readBuffer.data() + readBufferPos,
-                toRead,
-                writeBuffer.data() + writeBufferPos,
-                options.blockSize,
-                uncompressed,
-                options,
-                summaryData);
-            spdlog::trace("CompressedBytes: {}", compressedBytes);
-
-            readBufferPos += toRead;
-
-            if (compressedBytes > 0)
+        }
+        direct_file_input directInput(options.cacheSize / 4);
+        direct_file_output directOutput(options.cacheSize / 2);
+        if (options.directIo && !options.ioUring)
+        {
+            if (input == &inFile && !directInput.open(options.inputFile))
             {
-                writeBufferPos += compressedBytes;
-
-                spdlog::trace(
-                    "Output Position: {} - Output Buffer Size: {} - Output Buffer Position: {} - Block Compressed Size: {}",
-                    (uint64_t)outFile.tellg(),
-                    writeBuffer.size(),
-                    writeBufferPos,
-                    compressedBytes);
-
-                if (
-                    ((writeBuffer.size() - writeBufferPos) < (options.blockSize * 2)) ||
-                    (currentBlock == (blocksNumber - 2)))
-                {
-                    spdlog::trace("Flushing write buffer...");
-                    outFile.write(writeBuffer.data(), writeBufferPos);
-                    writeBufferPos = 0;
-                }
+                spdlog::warn("The input file cannot be opened using direct I/O, so it will be read using the standard method.");
+            }
+            else if (input == &inFile)
+            {
+                input = &directInput;
+            }
+            if (directOutput.open(options.outputFile))
+            {
+                output = &directOutput;
             }
             else
             {
-                spdlog::error("There was an error compressing the source file.");
-                return_code = 1;
-                goto exit;
+                spdlog::warn("The output file cannot be opened using direct I/O, so it will be written using the standard method.");
             }
-
-            // Set the current block start point with the uncompressed flag
-            blocks[currentBlock] = (blockStartPosition >> fileHeader.indexShift) | ((uint32_t)uncompressed << 31);
-
-            // Update the progress
-            progress_compress((uint64_t)inFile.tellg() + readBufferPos, inputSize, blockStartPosition - headerSize, lastProgress);
         }
-
-        spdlog::trace("Aligning the last block from: {}...", (uint64_t)outFile.tellp());
-        // Align the file and set the eof position block
-        file_align(outFile, fileHeader.indexShift);
-        uint64_t blockEndPosition = outFile.tellp();
-        blocks[blocksNumber - 1] = (blockEndPosition >> fileHeader.indexShift);
-        spdlog::trace("Aligned block position: {}...", (uint64_t)outFile.tellp());
-
-        // The HDL_dump bug trims the data at the end of the file if doesn't fit into a 2048 multiple.
-        // This fix will pad the output file to the nearest 2048 bytes multiple.
-        if (options.hdlFix)
+        if (options.dropCache)
         {
-            spdlog::trace("Aplying the HDL fix to avoid the files to be truncated on copy");
-            file_align(outFile, 11);
+            // Only the standard file access uses the system cache hints
+            inFile.set_drop_cache(input == &inFile);
+            outFile.set_writeback(output == &outFile ? options.cacheSize : 0);
         }
+        iso_file_map fileMap;
+        if (options.useFileMap)
+        {
+            if (is_cdrom(*input))
+            {
+                spdlog::warn("The file map is not available for CD-ROM raw images, so all the blocks will be compressed using the same method.");
+            }
+            else if (fileMap.load(*input))
+            {
+                options.fileMap = &fileMap;
+                spdlog::info("{:<20s} {} files", "File map:", fileMap.get_files());
+                spdlog::info("{:<20s} {} bytes", "Raw files:", fileMap.get_size(REGION_RAW));
+                spdlog::info("{:<20s} {} bytes", "LZ4HC files:", fileMap.get_size(REGION_HC));
+            }
+            else
+            {
+                spdlog::warn("The ISO9660 filesystem cannot be read, so all the blocks will be compressed using the same method.");
+            }
+        }
+        ziso_encoder encoder(options);
+        encoder.set_progress_callback([&](uint64_t currentInput, uint64_t currentOutput)
+                                      { progress_compress(currentInput, inputSize, currentOutput, lastProgress); });
 
-        // Write the blocks index
-        spdlog::trace("Writting the index data (overwrite)");
-        outFile.seekp(0x18);
-        outFile.write((const char *)blocks.data(), blocksNumber * sizeof(uint32_t));
-        spdlog::trace("Writen {} bytes at {} position", blocksNumber * sizeof(uint32_t), 0x18);
-
-        outFile.seekp(0, std::ios_base::end);
-        show_summary(outFile.tellp(), options, summaryData);
-    }
-    else
-    {
-        spdlog::info("Decompressing the input file.");
-        // Get the input size
-        inFile.seekg(0, std::ios_base::end);
-        inputSize = inFile.tellg();
-        inFile.seekg(0, std::ios_base::beg);
-        spdlog::debug("The input file size is {} bytes.", inputSize);
-
-        // Read the header
-        inFile.read(reinterpret_cast<char *>(&fileHeader), sizeof(fileHeader));
-
-        // Calculate the blocks number
-        blocksNumber = ceil((float)fileHeader.uncompressedSize / fileHeader.blockSize) + 1;
-
-        // Reserve and read the blocks index
-        blocks.resize(blocksNumber, 0);
-        inFile.read((char *)blocks.data(), blocksNumber * sizeof(uint32_t));
-
-        // Set the options blocksize from the fileheader blocksize
-        options.blockSize = fileHeader.blockSize;
-
-        // Print the sumary
-        spdlog::info("{:<20s} {}", "Source:", options.inputFile.c_str());
-        spdlog::info("{:<20s} {}", "Destination:", options.outputFile.c_str());
-        spdlog::info("{:<20s} {} bytes", "Total File Size:", fileHeader.uncompressedSize);
-        spdlog::info("{:<20s} {}", "Block Size:", fileHeader.blockSize);
-        spdlog::info("{:<20s} {}", "Index align:", fileHeader.indexShift);
-        spdlog::debug("Number of blocks in file: {}.", blocksNumber - 1);
-
-        // Check if the input file is damaged
-        uint64_t headerFileSize = uint64_t(blocks[blocksNumber - 1] & 0x7FFFFFFF) << fileHeader.indexShift;
-        // Check if the file was fixed against the hdl_dump bug
-        uint64_t hdlFixHeaderFileSize = headerFileSize;
-        if (headerFileSize % 2048)
+        if (!encoder.encode(*input, *output))
         {
-            hdlFixHeaderFileSize = ((headerFileSize >> 11) + 1) << 11;
+            return_code = 1;
+            goto exit;
         }
 
-        if (headerFileSize != inputSize && hdlFixHeaderFileSize != inputSize && options.ignoreHeaderSize == false)
+        // The padding of the last sector is removed when the file is closed
+        if (output == &directOutput && !directOutput.close())
         {
-            // The input file doesn't matches the index data and maybe is damaged
-            spdlog::error("The input file header is corrupt. Filesize doesn't matches.");
-            spdlog::debug("Input file size: {} - Header file size: {} - hdlFixed size: {}.", inputSize, headerFileSize, hdlFixHeaderFileSize);
+            spdlog::error("There was an error setting the output file size.");
             return_code = 1;
             goto exit;
         }
 
-        // Read buffer. The input block size is not fixed, so cannot be calculated and we will use the cache size.
-        uint32_t readBufferSize = options.cacheSize;
-        if (inputSize < readBufferSize)
+        show_summary(encoder.get_output_size(), options, encoder.get_summary());
+        if (options.targetSize && encoder.get_output_size() > options.targetSize)
         {
-            readBufferSize = inputSize;
+            spdlog::warn("The output file is bigger than the target size, even using the best compression.");
         }
-        uint32_t readBufferPos = readBufferSize; // Set the position to the End Of Buffer to force a fill at the first loop.
-        std::vector<char> readBuffer(readBufferSize, 0);
-        // Write buffer. To make it easier to manage, we will create a buffer with a size of a multiple of the blockSize.
-        uint32_t writeBufferSize = options.cacheSize - (options.cacheSize % options.blockSize);
-        uint32_t writeBufferPos = 0;
-        std::vector<char> writeBuffer(writeBufferSize, 0);
-
-        for (uint32_t currentBlock = 0; currentBlock < blocksNumber - 1; currentBlock++)
+        if (!options.targetSize && options.maxTime &&
+            std::chrono::high_resolution_clock::now() - start > std::chrono::seconds(options.maxTime))
         {
-            bool uncompressed = blocks[currentBlock] & 0x80000000;
-            uint64_t blockStartPosition = uint64_t(blocks[currentBlock] & 0x7FFFFFFF) << fileHeader.indexShift;
-            uint64_t blockEndPosition = uint64_t(blocks[currentBlock + 1] & 0x7FFFFFFF) << fileHeader.indexShift;
-            uint64_t currentBlockSize = blockEndPosition - blockStartPosition;
-
-            spdlog::trace(
-                "Current Block: {} - Block Start Position: {} - Block End Position: {} - Block Size: {} - Uncompressed: {}",
-                currentBlock + 1,
-                blockStartPosition,
-                blockEndPosition,
-                currentBlockSize,
-                uncompressed);
-
-            // The current block size cannot exceed 2 x blockSize.
-            if (currentBlockSize > (fileHeader.blockSize * 2))
-            {
-                // Looks like the header is corrupted
-                spdlog::error("The input file header is corrupt. Corrupted index block.");
-                return_code = 1;
-                goto exit;
-            }
-
-            //  If the current reader position is the end of the buffer, fill the buffer with new data
-            if (uint32_t leftInReadBuffer = readBufferSize - readBufferPos;
-                currentBlockSize > leftInReadBuffer)
+            spdlog::warn("The compression took longer than the max time, even using the fastest compression.");
+        }
+    }
+    else
+    {
+        spdlog::info("Decompressing the input file.");
+        ziso_input *input = &inFile;
+        ziso_output *output = &outFile;
+        uring_file uringInput;
+        uring_file uringOutput;
+        if (options.ioUring)
+        {
+            if (uringInput.open(options.inputFile, false) && uringOutput.open(options.outputFile, true))
             {
-                // At the first block, the input file must be synced to the start point or can be missaligned
-                if (currentBlock == 0)
-                {
-                    inFile.seekg(blockStartPosition);
-                }
-                spdlog::trace("The reader buffer is empty... reading more data.");
-                // Get the data left in file
-                uint64_t leftInFile = inputSize - inFile.tellg();
-                spdlog::trace("There are {} bytes left in the file.", leftInFile);
-
-                // To Read
-                uint64_t toRead = readBufferSize - leftInReadBuffer;
-                if (toRead > leftInFile)
-                {
-                    toRead = leftInFile;
-                }
-                spdlog::trace("{} bytes will be read.", toRead);
-
-                // Move the data buffer to the start point
-                std::memmove(readBuffer.data(), readBuffer.data() + readBufferPos, leftInReadBuffer);
-                spdlog::trace("Current file position: {}", (uint64_t)inFile.tellp());
-                inFile.read(readBuffer.data() + leftInReadBuffer, toRead);
-                spdlog::trace("New file position: {}", (uint64_t)inFile.tellp());
-                readBufferPos = 0;
+                input = &uringInput;
+                output = &uringOutput;
             }
-
-            int decompressedBytes = decompress_block(
-                readBuffer.data() + readBufferPos,
-                currentBlockSize,
-                writeBuffer.data() + writeBufferPos,
-                options.blockSize,
-                uncompressed);
-
-            if (currentBlock == (blocksNumber - 2))
+            else
             {
-                // The LZ4 compressor seems not to be taking into account of the input data size to limit the decompressed data
-                // Or at least is not reporting the correct decompressed size.
-                // This is a fix to avoid this problem calculating the correct last block size instead to use the LZ4 compressor reported size.
-                decompressedBytes = fileHeader.uncompressedSize - ((uint64_t)outFile.tellp() + writeBufferPos);
-                spdlog::trace("Fixed the last block size to: {}", decompressedBytes);
+                spdlog::warn("The io_uring interface is not available, so the files will be accessed using the standard method.");
             }
-
-            spdlog::trace("Decompressed data bytes: {}", decompressedBytes);
-
-            if (decompressedBytes > 0)
+        }
+        direct_file_input directInput(options.cacheSize);
+        direct_file_output directOutput(options.cacheSize);
+        if (options.directIo && !options.ioUring)
+        {
+            if (directInput.open(options.inputFile) && directOutput.open(options.outputFile))
             {
-                readBufferPos += currentBlockSize;
-                writeBufferPos += decompressedBytes;
-
-                if (
-                    writeBufferPos >= (writeBufferSize - 1) ||
-                    (currentBlock == (blocksNumber - 2)))
-                {
-                    outFile.write(writeBuffer.data(), writeBufferPos);
-                    writeBufferPos = 0;
-                }
+                input = &directInput;
+                output = &directOutput;
             }
             else
             {
-                spdlog::error("There was an error decompressing the source file.");
-                return_code = 1;
-                goto exit;
+                spdlog::warn("The files cannot be opened using direct I/O, so they will be accessed using the standard method.");
             }
+        }
+        if (options.dropCache)
+        {
+            // Only the standard file access uses the system cache hints
+            inFile.set_drop_cache(input == &inFile);
+            outFile.set_writeback(output == &outFile ? options.cacheSize : 0);
+        }
+        ziso_decoder decoder(options.threads, options.cacheSize);
+        decoder.set_progress_callback([&](uint64_t currentInput, uint64_t totalInput)
+                                      { progress_decompress(currentInput, totalInput, lastProgress); });
+
+        // Read the header and the blocks index
+        if (!decoder.open(*input, options.ignoreHeaderSize))
+        {
+            return_code = 1;
+            goto exit;
+        }
+        const zheader &fileHeader = decoder.get_header();
+
+        // Print the sumary
+        spdlog::info("{:<20s} {}", "Source:", options.inputFile.c_str());
+        spdlog::info("{:<20s} {}", "Destination:", options.outputFile.c_str());
+        spdlog::info("{:<20s} {} bytes", "Total File Size:", fileHeader.uncompressedSize);
+        spdlog::info("{:<20s} {}", "Block Size:", fileHeader.blockSize);
+        spdlog::info("{:<20s} {}", "Index align:", fileHeader.indexShift);
 
-            progress_decompress(inFile.tellg(), inputSize, lastProgress);
+        if (!decoder.decode(*output))
+        {
+            return_code = 1;
+            goto exit;
         }
 
-        if ((uint64_t)outFile.tellp() != fileHeader.uncompressedSize)
+        // The padding of the last sector is removed when the file is closed
+        if (output == &directOutput && !directOutput.close())
         {
-            spdlog::error("The output filesize doesn't matches the header filesize. {} vs {}", fileHeader.uncompressedSize, (uint64_t)outFile.tellp());
+            spdlog::error("There was an error setting the output file size.");
             return_code = 1;
+            goto exit;
         }
     }
 
 exit:
-    if (inFile.is_open())
-    {
-        inFile.close();
-    }
-    if (outFile.is_open())
-    {
-        outFile.close();
-    }
+    inFile.close();
+    outFile.close();
 
     if (return_code == 0)
     {
@@ -597,11 +496,9 @@ exit:
             // Something went wrong, so output file must be deleted if keep == false
             // We will remove the file if something went wrong
             spdlog::error("there was an error processing the input file.");
-            std::ifstream out_remove_tmp(options.outputFile.c_str(), std::ios::binary);
-            char dummy;
-            if (out_remove_tmp.read(&dummy, 0))
+            std::error_code existsError;
+            if (std::filesystem::exists(options.outputFile, existsError))
             {
-                out_remove_tmp.close();
                 if (remove(options.outputFile.c_str()))
                 {
                     spdlog::error("There was an error removing the output file... Please remove it manually.");
@@ -612,226 +509,28 @@ exit:
     return return_code;
 }
 
-inline uint32_t compress_block(
-    const char *src,
-    uint32_t srcSize,
-    char *dst,
-    uint32_t dstSize,
-    bool &uncompressed,
-    const opt &options,
-    summary &summaryData)
-{
-    // The source size will be the same always
-    summaryData.sourceSize += srcSize;
-
-    // Try to compress the data into the dst buffer
-    uint32_t outSize = 0;
-    if (options.bruteForce)
-    {
-        // This method will try all the available compression methods to select the most apropiate.
-        uint32_t lz4Size = 0;
-        uint32_t lz4Method2Size = 0;
-
-        std::vector<char> lz4Buffer(LZ4_compressBound(dstSize), 0);
-        std::vector<char> lz4Method2Buffer(LZ4_compressBound(dstSize), 0);
-
-        // Compress using the standard methods
-        // Method 1
-        LZ4_stream_t lz4_state;
-        LZ4_resetStream(&lz4_state);
-        lz4Size = LZ4_compress_fast_continue(&lz4_state, src, lz4Buffer.data(), srcSize, dstSize, lz4_compression_level[options.compressionLevel - 1]);
-        // Method 2
-        lz4Method2Size = LZ4_compress_fast(src, lz4Method2Buffer.data(), srcSize, dstSize, lz4_compression_level[options.compressionLevel - 1]);
-
-        // Get the smaller output between all the methods
-        if (lz4Size > 0 && (lz4Size < outSize || outSize == 0))
-        {
-            outSize = lz4Size;
-        }
-        if (lz4Method2Size > 0 && (lz4Method2Size < outSize || outSize == 0))
-        {
-            outSize = lz4Method2Size;
-        }
-
-        // If there was an error compressing or the size is bigger than source, don't do anything.
-        if (outSize == 0 || outSize >= srcSize)
-        {
-            // The raw data will be copied later
-        }
-        // The methods priority are LZ4, LZ4 Method 2.
-        else if (lz4Size > 0 && outSize == lz4Size)
-        {
-            std::memcpy(dst, lz4Buffer.data(), lz4Size);
-
-            summaryData.lz4Count++;
-            summaryData.lz4In += srcSize;
-            summaryData.lz4Out += outSize;
-        }
-        else if (lz4Method2Size > 0 && outSize == lz4Method2Size)
-        {
-            std::memcpy(dst, lz4Method2Buffer.data(), lz4Method2Size);
-
-            summaryData.lz4m2Count++;
-            summaryData.lz4m2In += srcSize;
-            summaryData.lz4m2Out += outSize;
-        }
-        else
-        {
-            // Something weird
-            return 0;
-        }
-    }
-    else
-    {
-        if (options.lz4hc)
-        {
-            LZ4_streamHC_t lz4_state;
-            LZ4_resetStreamHC(&lz4_state, options.compressionLevel);
-            outSize = LZ4_compress_HC_continue(&lz4_state, src, dst, srcSize, dstSize);
-        }
-        else
-        {
-            if (options.alternativeLz4)
-            {
-                outSize = LZ4_compress_fast(src, dst, srcSize, dstSize, lz4_compression_level[options.compressionLevel - 1]);
-            }
-            else
-            {
-                LZ4_stream_t lz4_state;
-                LZ4_resetStream(&lz4_state);
-                outSize = LZ4_compress_fast_continue(&lz4_state, src, dst, srcSize, dstSize, lz4_compression_level[options.compressionLevel - 1]);
-            }
-        }
-    }
-
-    // If the block was not compressed because a buffer space problem, or the output is bigger than input
-    //
-    if (outSize == 0 || outSize >= srcSize)
-    {
-        if (dstSize < srcSize)
-        {
-            // The block cannot be compressed and the raw data doesn't fit the dst buffer
-            return 0;
-        }
-        uncompressed = true;
-        std::memcpy(dst, src, srcSize);
-
-        summaryData.rawCount++;
-        summaryData.raw += srcSize;
-
-        return srcSize;
-    }
-    else
-    {
-        uncompressed = false;
-
-        // When brute force is used, summary data is added before.
-        if (!options.bruteForce)
-        {
-            if (options.lz4hc)
-            {
-                summaryData.lz4hcCount++;
-                summaryData.lz4hcIn += srcSize;
-                summaryData.lz4hcOut += outSize;
-            }
-            else
-            {
-                if (options.alternativeLz4)
-                {
-                    summaryData.lz4m2Count++;
-                    summaryData.lz4m2In += srcSize;
-                    summaryData.lz4m2Out += outSize;
-                }
-                else
-                {
-                    summaryData.lz4Count++;
-                    summaryData.lz4In += srcSize;
-                    summaryData.lz4Out += outSize;
-                }
-            }
-        }
-
-        return outSize;
-    }
-}
-
-inline uint32_t decompress_block(
-    const char *src,
-    uint32_t srcSize,
-    char *dst,
-    uint32_t dstSize,
-    bool uncompressed)
+bool is_cdrom(ziso_input &input)
 {
-    if (uncompressed)
-    {
-        // If the data is non compressed, then just copy the source data
-        if (dstSize > srcSize)
-        {
-            // The raw input data is less than the buffer
-            return 0;
-        }
-
-        std::memcpy(dst, src, dstSize);
-        return dstSize;
-    }
-    else
-    {
-        return LZ4_decompress_safe_partial(src, dst, srcSize, dstSize, dstSize);
-    }
-}
-
-bool is_cdrom(std::fstream &fIn)
-{
-    // Store the current position
-    uint64_t currentPos = fIn.tellg();
-
-    // Seek to the start point
-    fIn.seekg(0);
-
     // Read three sectors to ensure that the disk is a CDROM
     std::vector<char> buffer(12, 0);
     std::vector<char> cdSync = {(char)0x00, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0xFF, (char)0x00};
     for (uint8_t i = 0; i < 3; i++)
     {
-        fIn.seekg(i * 2352);
-        fIn.read(buffer.data(), buffer.size());
+        // Small files will fail when reading beyond the end of the file
+        if (!input.read(i * 2352, buffer.data(), buffer.size()))
+        {
+            break;
+        }
 
         //  Check if they matches
         if (buffer == cdSync)
         {
-            fIn.seekg(currentPos);
             return true;
         }
     }
-    fIn.seekg(currentPos);
     return false;
 }
 
-void file_align(std::fstream &fOut, uint8_t shift)
-{
-    if (uint16_t paddingLostBytes = fOut.tellp() % (1 << shift);
-        paddingLostBytes)
-    {
-        uint16_t alignment = (1 << shift) - paddingLostBytes;
-        for (uint64_t i = 0; i < alignment; i++)
-        {
-            fOut.write("\0", 1);
-        }
-    }
-}
-
-uint16_t buffer_align(char *buffer, uint64_t currentPosition, uint8_t shift)
-{
-    if (uint16_t paddingLostBytes = currentPosition % (1 << shift);
-        paddingLostBytes)
-    {
-        uint16_t alignment = (1 << shift) - paddingLostBytes;
-        std::memset(buffer, 0, alignment);
-        return alignment;
-    }
-    return 0;
-}
-
 int get_options(
     int argc,
     char **argv,
@@ -1031,12 +730,356 @@ int get_options(
             options.ignoreHeaderSize = true;
             break;
 
+        // Long option --threads
+        case 18:
+            try
+            {
+                optarg_s = optarg;
+                temp_argument = std::stoi(optarg_s);
+
+                if (temp_argument > THREADS_MAX)
+                {
+                    std::print(std::cerr, "\n\nERROR: the provided threads number is not correct. Must be less than {}\n\n", THREADS_MAX);
+                    print_help();
+                    return 1;
+                }
+                else if (temp_argument == 0)
+                {
+                    // Use all the available cores
+                    options.threads = std::max(1U, std::thread::hardware_concurrency());
+                }
+                else
+                {
+                    options.threads = (uint16_t)temp_argument;
+                }
+            }
+            catch (std::exception const &e)
+            {
+                std::print(std::cerr, "\n\nERROR: the provided threads number is not correct.\n\n");
+                print_help();
+                return 1;
+            }
+            break;
+
+        // Long option --mmap
+        case 19:
+            options.mmapInput = true;
+            break;
+
+        // Long option --io-uring
+        case 20:
+            options.ioUring = true;
+            break;
+
+        // Long option --direct-io
+        case 21:
+            options.directIo = true;
+            break;
+
+        // Long option --drop-cache
+        case 22:
+            options.dropCache = true;
+            break;
+
+        // Long option --duplicates-cache
+        case 23:
+            try
+            {
+                optarg_s = optarg;
+                temp_argument = std::stoi(optarg_s);
+
+                if (temp_argument > DUPLICATES_CACHE_SIZE_MAX)
+                {
+                    std::print(std::cerr, "\n\nERROR: the provided duplicates cache size is not correct. Must be between 0 and {}MB\n\n", DUPLICATES_CACHE_SIZE_MAX);
+                    print_help();
+                    return 1;
+                }
+                else
+                {
+                    options.duplicatesCacheSize = (uint32_t)temp_argument * (1024 * 1024);
+                }
+            }
+            catch (std::exception const &e)
+            {
+                std::print(std::cerr, "\n\nERROR: the provided duplicates cache size is not correct.\n\n");
+                print_help();
+                return 1;
+            }
+            break;
+
+        // Long option --entropy-threshold
+        case 24:
+            try
+            {
+                optarg_s = optarg;
+                float threshold = std::stof(optarg_s);
+
+                if (threshold < 0 || threshold > 8)
+                {
+                    std::print(std::cerr, "\n\nERROR: the provided entropy threshold is not correct. Must be between 0 and 8 bits.\n\n");
+                    print_help();
+                    return 1;
+                }
+                else
+                {
+                    options.entropyThreshold = threshold;
+                }
+            }
+            catch (std::exception const &e)
+            {
+                std::print(std::cerr, "\n\nERROR: the provided entropy threshold is not correct.\n\n");
+                print_help();
+                return 1;
+            }
+            break;
+
+        // Long option --file-map
+        case 25:
+            options.useFileMap = true;
+            break;
+
+        // Long option --exhaustive
+        case 26:
+            options.exhaustive = true;
+            break;
+
+        // Long option --two-tier
+        case 27:
+            options.twoTier = true;
+            options.lz4hc = true;
+            break;
+
+        // Long option --min-saving
+        case 28:
+            try
+            {
+                optarg_s = optarg;
+                if (optarg_s == "auto")
+                {
+                    options.minSaving = MIN_SAVING_MODEL;
+                    break;
+                }
+                int minSaving = std::stoi(optarg_s);
+
+                if (minSaving < 0 || minSaving > MIN_SAVING_MAX)
+                {
+                    std::print(std::cerr, "\n\nERROR: the provided min saving is not correct. Must be between 0 and {}%, or auto.\n\n", MIN_SAVING_MAX);
+                    print_help();
+                    return 1;
+                }
+                else
+                {
+                    options.minSaving = minSaving;
+                }
+            }
+            catch (std::exception const &e)
+            {
+                std::print(std::cerr, "\n\nERROR: the provided min saving is not correct.\n\n");
+                print_help();
+                return 1;
+            }
+            break;
+
+        // Long option --favor-decompression
+        case 29:
+            options.favorDecompression = true;
+            options.lz4hc = true;
+            break;
+
+        // Long option --target-size
+        case 30:
+            try
+            {
+                optarg_s = optarg;
+                size_t suffix = 0;
+                uint64_t targetSize = std::stoull(optarg_s, &suffix);
+
+                // The size can use the K, M and G suffixes
+                std::string unit = optarg_s.substr(suffix);
+                if (unit == "K" || unit == "k")
+                {
+                    targetSize *= 1024;
+                }
+                else if (unit == "M" || unit == "m")
+                {
+                    targetSize *= 1024 * 1024;
+                }
+                else if (unit == "G" || unit == "g")
+                {
+                    targetSize *= 1024 * 1024 * 1024;
+                }
+                else if (!unit.empty())
+                {
+                    throw std::invalid_argument("Wrong unit");
+                }
+
+                if (targetSize == 0)
+                {
+                    std::print(std::cerr, "\n\nERROR: the provided target size is not correct. Must be bigger than 0.\n\n");
+                    print_help();
+                    return 1;
+                }
+                else
+                {
+                    options.targetSize = targetSize;
+                }
+            }
+            catch (std::exception const &e)
+            {
+                std::print(std::cerr, "\n\nERROR: the provided target size is not correct.\n\n");
+                print_help();
+                return 1;
+            }
+            break;
+
+        // Long option --max-time
+        case 31:
+            try
+            {
+                optarg_s = optarg;
+                int maxTime = std::stoi(optarg_s);
+
+                if (maxTime <= 0)
+                {
+                    std::print(std::cerr, "\n\nERROR: the provided max time is not correct. Must be bigger than 0 seconds.\n\n");
+                    print_help();
+                    return 1;
+                }
+                else
+                {
+                    options.maxTime = maxTime;
+                }
+            }
+            catch (std::exception const &e)
+            {
+                std::print(std::cerr, "\n\nERROR: the provided max time is not correct.\n\n");
+                print_help();
+                return 1;
+            }
+            break;
+
+        // Long option --min-throughput
+        case 32:
+            try
+            {
+                optarg_s = optarg;
+                float minThroughput = std::stof(optarg_s);
+
+                if (minThroughput <= 0)
+                {
+                    std::print(std::cerr, "\n\nERROR: the provided min throughput is not correct. Must be bigger than 0 MB/s.\n\n");
+                    print_help();
+                    return 1;
+                }
+                else
+                {
+                    options.minThroughput = minThroughput;
+                }
+            }
+            catch (std::exception const &e)
+            {
+                std::print(std::cerr, "\n\nERROR: the provided min throughput is not correct.\n\n");
+                print_help();
+                return 1;
+            }
+            break;
+
+        // Long option --sector-layout
+        case 33:
+            try
+            {
+                optarg_s = optarg;
+                if (optarg_s == "auto")
+                {
+                    options.sectorLayout = SECTOR_LAYOUT_MODEL;
+                    break;
+                }
+                int sectorLayout = std::stoi(optarg_s);
+
+                if (sectorLayout < 1 || sectorLayout >= (int)SECTOR_LAYOUT_SIZE)
+                {
+                    std::print(std::cerr, "\n\nERROR: the provided sector layout padding is not correct. Must be between 1 and {} bytes, or auto.\n\n", SECTOR_LAYOUT_SIZE - 1);
+                    print_help();
+                    return 1;
+                }
+                else
+                {
+                    options.sectorLayout = sectorLayout;
+                }
+            }
+            catch (std::exception const &e)
+            {
+                std::print(std::cerr, "\n\nERROR: the provided sector layout padding is not correct.\n\n");
+                print_help();
+                return 1;
+            }
+            break;
+
+        // Long option --two-tier-min
+        case 34:
+            try
+            {
+                optarg_s = optarg;
+                int ratio = std::stoi(optarg_s);
+
+                if (ratio < 0 || ratio > 99)
+                {
+                    std::print(std::cerr, "\n\nERROR: the provided two-tier min ratio is not correct. Must be between 0 and 99%.\n\n");
+                    print_help();
+                    return 1;
+                }
+                else
+                {
+                    options.twoTierMinRatio = ratio;
+                }
+            }
+            catch (std::exception const &e)
+            {
+                std::print(std::cerr, "\n\nERROR: the provided two-tier min ratio is not correct.\n\n");
+                print_help();
+                return 1;
+            }
+            break;
+
+        // Long option --two-tier-max
+        case 35:
+            try
+            {
+                optarg_s = optarg;
+                int ratio = std::stoi(optarg_s);
+
+                if (ratio < 1 || ratio > 100)
+                {
+                    std::print(std::cerr, "\n\nERROR: the provided two-tier max ratio is not correct. Must be between 1 and 100%.\n\n");
+                    print_help();
+                    return 1;
+                }
+                else
+                {
+                    options.twoTierMaxRatio = ratio;
+                }
+            }
+            catch (std::exception const &e)
+            {
+                std::print(std::cerr, "\n\nERROR: the provided two-tier max ratio is not correct.\n\n");
+                print_help();
+                return 1;
+            }
+            break;
+
         default:
             print_help();
             return 1;
         }
     }
 
+    if (options.twoTierMinRatio >= options.twoTierMaxRatio)
+    {
+        std::print(std::cerr, "\n\nERROR: the two-tier min ratio must be lower than the max ratio.\n\n");
+        print_help();
+        return 1;
+    }
+
     return 0;
 }
 
@@ -1066,7 +1109,7 @@ void print_help()
                "    --brute-force\n"
                "           SLOW: Try to compress using the two LZ4 methods. LZ4HC already selects the best compression method.\n"
                "    --cache-size <size>\n"
-               "           The size of the cache buffer in MB. By default {}. Memory usage will be the double ({}MB Read + {}MB Write).\n"
+               "           The size of the cache buffer in MB. By default {}. Memory usage will be about 1.75 times when compressing ({}MB Read + {}MB Slots + {}MB Write) and 3 times when decompressing.\n"
                "    --hdl-fix\n"
                "           Add a padding in the output file to the nearest upper 2048 bytes multiple (hdl_dump bug fix).\n"
                "    --log-file\n"
@@ -1075,8 +1118,44 @@ void print_help()
                "           Set the log level between the following levels: trace, debug, info, warn, err, critical, off\n"
                "    --ignore-header-size\n"
                "           Ignore the output size stored in the header. Usefull to try to decompress the file even when file size is corrupted.\n"
+               "    --threads <number>\n"
+               "           Number of threads used to compress or decompress the blocks. By default 1. Use 0 to use all the available cores.\n"
+               "    --mmap\n"
+               "           Map the input file into memory when compressing, to read it directly from the system cache.\n"
+               "    --io-uring\n"
+               "           Use the Linux io_uring interface to read and write the files, sending several requests at once to the drive.\n"
+               "    --direct-io\n"
+               "           Read and write the files bypassing the system cache, using aligned buffers sized from the cache size. Ignored with --io-uring.\n"
+               "    --drop-cache\n"
+               "           Remove the processed data from the system cache and write the output progressively, to keep the memory usage low.\n"
+               "    --duplicates-cache <size>\n"
+               "           Memory in MB used to remember the compressed blocks, so the repeated blocks are copied instead of compressed. By default 0 (disabled).\n"
+               "    --entropy-threshold <bits>\n"
+               "           Store without compression the blocks with an entropy (0 to 8 bits per byte) equal or higher than the threshold. By default 0 (disabled).\n"
+               "    --file-map\n"
+               "           Read the ISO9660 filesystem to store the media files without compression, and compress the executables and archives using LZ4HC.\n"
+               "    --exhaustive\n"
+               "           VERY SLOW: Try all the LZ4 accelerations and LZ4HC levels in every block and keep the smallest output.\n"
+               "    --two-tier\n"
+               "           Compress every block using LZ4 first, and use LZ4HC only in the blocks where it can reduce the size. Implies --lz4hc.\n"
+               "    --two-tier-min <percent>\n"
+               "           Min LZ4 ratio (output size in percent of the block size) where the two-tier compression tries LZ4HC. By default {}%.\n"
+               "    --two-tier-max <percent>\n"
+               "           Max LZ4 ratio where the two-tier compression tries LZ4HC. By default {}%.\n"
+               "    --favor-decompression\n"
+               "           Avoid the LZ4HC matches which are slow to decompress, so the image is faster to read on slow devices at a small size cost. Implies --lz4hc.\n"
+               "    --target-size <size>\n"
+               "           Select the fastest LZ4 or LZ4HC level which fits the output into this size (in bytes, or with a K, M or G suffix). The input is sampled to estimate the size and the level is adjusted in every chunk.\n"
+               "    --max-time <seconds>\n"
+               "           Select the best LZ4 or LZ4HC level which allows to finish the compression in this time. The throughput is measured and the level is adjusted in every chunk.\n"
+               "    --min-throughput <MB/s>\n"
+               "           Select the best LZ4 or LZ4HC level which compresses at least at this speed. Can be combined with --max-time.\n"
+               "    --sector-layout <bytes|auto>\n"
+               "           Add a padding before the blocks which would cross an extra device sector of 2048 bytes, so they are read with one less device read. Use auto to pay the padding which is read in the time of a read request in the decode cost model ({}us at 4MB/s, {} bytes), or a number to set the bytes paid for every avoided read. The reads avoided or added in the next block are also counted. The padding is included in the index shift selection, and only used with an index shift of 11 or less.\n"
+               "    --min-saving <percent|auto>\n"
+               "           Store without compression the blocks which save less than this plain percent of the block size, because they are faster to read than to decompress on slow devices. Use auto to require the saving whose read time pays the decompression time in the decode cost model (4MB/s read and 40MB/s LZ4 decompression, a 10% of the block). By default 0 (disabled).\n"
                "\n",
-               CACHE_SIZE_DEFAULT, CACHE_SIZE_DEFAULT, CACHE_SIZE_DEFAULT);
+               CACHE_SIZE_DEFAULT, CACHE_SIZE_DEFAULT / 2, CACHE_SIZE_DEFAULT / 4, CACHE_SIZE_DEFAULT, TWO_TIER_MIN_RATIO, TWO_TIER_MAX_RATIO, DECODE_MODEL_READ_LATENCY, SECTOR_LAYOUT_MODEL_COST);
 }
 
 static void progress_compress(uint64_t currentInput, uint64_t totalInput, uint64_t currentOutput, uint8_t &lastProgress)
@@ -1114,15 +1193,16 @@ static void show_summary(uint64_t outputSize, const opt &options, const summary
     std::print(std::cout, "---------------------------------------------------------------\n");
     std::print(std::cout, " Type                Sectors         In Size          Out Size \n");
     std::print(std::cout, "---------------------------------------------------------------\n");
-    if (options.bruteForce || (!options.lz4hc && !options.alternativeLz4))
+    bool tiers = options.targetSize || options.maxTime || options.minThroughput > 0;
+    if (options.bruteForce || options.exhaustive || options.twoTier || tiers || (!options.lz4hc && !options.alternativeLz4))
     {
         std::print(std::cout, " LZ4 ............... {:7d} ...... {:7.2f}MB ...... {:7.2f}MB\n", (unsigned long long)summaryData.lz4Count, MB(summaryData.lz4In), MB(summaryData.lz4Out));
     }
-    if (options.bruteForce || (!options.lz4hc && options.alternativeLz4))
+    if (!tiers && (options.bruteForce || options.exhaustive || (!options.lz4hc && options.alternativeLz4)))
     {
         std::print(std::cout, " LZ4 M2 ............ {:7d} ...... {:7.2f}MB ...... {:7.2f}MB\n", (unsigned long long)summaryData.lz4m2Count, MB(summaryData.lz4m2In), MB(summaryData.lz4m2Out));
     }
-    if (!options.bruteForce && options.lz4hc)
+    if ((!options.bruteForce && options.lz4hc) || summaryData.lz4hcCount)
     {
         std::print(std::cout, " LZ4HC ............. {:7d} ...... {:7.2f}MB ...... {:7.2f}MB\n", (unsigned long long)summaryData.lz4hcCount, MB(summaryData.lz4hcIn), MB(summaryData.lz4hcOut));
     }
@@ -1130,5 +1210,84 @@ static void show_summary(uint64_t outputSize, const opt &options, const summary
     std::print(std::cout, "---------------------------------------------------------------\n");
     std::print(std::cout, " Total ............. {:7d} ...... {:7.2f}MB ...... {:7.2f}MB\n", (unsigned long)total_sectors, MB(summaryData.sourceSize), MB(outputSize));
     std::print(std::cout, " ZSO reduction (input vs ZSO) ...................... {:8.2f}%\n", (1.0 - (outputSize / (float)summaryData.sourceSize)) * 100);
+    std::print(std::cout, " Zero filled blocks ................................ {:8d}\n", (unsigned long long)summaryData.zeroCount);
+    std::print(std::cout, " Index shift / worst case .......................... {:8d} / {}\n", (unsigned long long)summaryData.indexShift, (unsigned long long)summaryData.indexShiftWorstCase);
+    if (summaryData.layoutRestarts)
+    {
+        std::print(std::cout, " Compressed again to increase the shift ............ {:8d}\n", (unsigned long long)summaryData.layoutRestarts);
+    }
+    if (options.sectorLayout)
+    {
+        std::print(std::cout, " Sector straddles avoided / padding bytes .......... {:8d} / {}\n", (unsigned long long)summaryData.sectorStraddlesAvoided, (unsigned long long)summaryData.sectorPadding);
+        std::print(std::cout, " Sector straddles remaining ........................ {:8d}\n", (unsigned long long)summaryData.sectorStraddles);
+    }
+    if (options.duplicatesCacheSize)
+    {
+        std::print(std::cout, " Duplicated blocks (cache hits) .................... {:8d}\n", (unsigned long long)summaryData.duplicatesHits);
+        std::print(std::cout, " Duplicates cache hit rate ......................... {:8.2f}%\n", summaryData.duplicatesLookups ? (summaryData.duplicatesHits * 100.0) / summaryData.duplicatesLookups : 0.0);
+    }
+    if ((options.twoTier && options.lz4hc && !options.bruteForce && !options.exhaustive) || summaryData.tierTwoTierChunks)
+    {
+        std::print(std::cout, " LZ4HC attempts / skipped .......................... {:8d} / {}\n", (unsigned long long)summaryData.twoTierHc, (unsigned long long)summaryData.twoTierSkipped);
+        std::print(std::cout, " Skipped and checked / bytes lost .................. {:8d} / {}\n", (unsigned long long)summaryData.twoTierChecked, (unsigned long long)summaryData.twoTierCheckedLost);
+        std::print(std::cout, " Estimated bytes lost vs LZ4HC ..................... {:8d}\n", (unsigned long long)(summaryData.twoTierChecked ? (summaryData.twoTierCheckedLost * summaryData.twoTierSkipped) / summaryData.twoTierChecked : 0));
+
+        // LZ4HC in every block spends the time of the LZ4HC attempts, plus the average time of the checked blocks in the
+        // skipped ones. The two-tier compression spends the LZ4HC attempts and the LZ4 pass of every block.
+        double skippedTime = summaryData.twoTierChecked ? (double)summaryData.twoTierCheckedTime * summaryData.twoTierSkipped / summaryData.twoTierChecked : 0;
+        double hcTime = summaryData.twoTierHcTime + skippedTime;
+        double savedTime = hcTime - (summaryData.twoTierHcTime + summaryData.twoTierFastTime);
+        std::print(std::cout, " Estimated CPU time saved vs LZ4HC ................. {:8.2f}s / {:.2f}%\n", savedTime / 1e9, hcTime > 0 ? (savedTime * 100) / hcTime : 0.0);
+    }
+    if (options.favorDecompression && options.lz4hc && !options.bruteForce && !options.exhaustive)
+    {
+        // Decode speed in MB/s of the checked blocks, compressed favoring the decompression speed and normally
+        double favorSpeed = summaryData.favorCheckedTime ? (summaryData.favorCheckedIn * 1000.0) / summaryData.favorCheckedTime : 0;
+        double normalSpeed = summaryData.normalCheckedTime ? (summaryData.favorCheckedIn * 1000.0) / summaryData.normalCheckedTime : 0;
+
+        std::print(std::cout, " Favor decompression checked blocks ................ {:8d}\n", (unsigned long long)summaryData.favorChecked);
+        std::print(std::cout, " Decode speed favor / normal LZ4HC ................. {:8.2f}MB/s / {:.2f}MB/s\n", favorSpeed, normalSpeed);
+        std::print(std::cout, " Ratio favor / normal LZ4HC ........................ {:8.2f}% / {:.2f}%\n",
+                   summaryData.favorCheckedIn ? (summaryData.favorCheckedOut * 100.0) / summaryData.favorCheckedIn : 0.0,
+                   summaryData.favorCheckedIn ? (summaryData.normalCheckedOut * 100.0) / summaryData.favorCheckedIn : 0.0);
+    }
+    if (options.targetSize)
+    {
+        std::print(std::cout, " Target size / estimated at start .................. {:8d} / {}\n", (unsigned long long)options.targetSize, (unsigned long long)summaryData.targetEstimated);
+        std::print(std::cout, " Target size reached ............................... {:>8s}\n", outputSize <= options.targetSize ? "Yes" : "No");
+    }
+    if (tiers)
+    {
+        std::print(std::cout, " Chunks with LZ4 / two-tier / LZ4HC ................ {:8d} / {} / {}\n", (unsigned long long)summaryData.tierLz4Chunks, (unsigned long long)summaryData.tierTwoTierChunks, (unsigned long long)summaryData.tierHcChunks);
+        std::print(std::cout, " Compression tier changes .......................... {:8d}\n", (unsigned long long)summaryData.tierChanges);
+    }
+    if (options.minSaving > 0)
+    {
+        // Estimated load time using the decode cost model, with and without the min saving
+        uint64_t compressedIn = summaryData.lz4In + summaryData.lz4m2In + summaryData.lz4hcIn;
+        uint64_t storedSize = summaryData.lz4Out + summaryData.lz4m2Out + summaryData.lz4hcOut + summaryData.raw;
+        double loadTime = (double)storedSize / DECODE_MODEL_READ_SPEED + (double)compressedIn / DECODE_MODEL_LZ4_SPEED;
+        double loadTimeBefore = (double)(storedSize - summaryData.minSavingLost) / DECODE_MODEL_READ_SPEED +
+                                (double)(compressedIn + summaryData.minSavingIn) / DECODE_MODEL_LZ4_SPEED;
+
+        std::print(std::cout, " RAW blocks by min saving / bytes lost ............. {:8d} / {}\n", (unsigned long long)summaryData.minSavingRaw, (unsigned long long)summaryData.minSavingLost);
+        std::print(std::cout, " Estimated load time / reduction ................... {:8.2f}s / {:.2f}s ({:.2f}%)\n", loadTime, loadTimeBefore - loadTime, loadTimeBefore > 0 ? ((loadTimeBefore - loadTime) * 100) / loadTimeBefore : 0.0);
+    }
+    if (options.exhaustive)
+    {
+        std::print(std::cout, " Exhaustive attempts / pruned ...................... {:8d} / {}\n", (unsigned long long)summaryData.exhaustiveAttempts, (unsigned long long)summaryData.exhaustivePruned);
+    }
+    if (options.fileMap)
+    {
+        std::print(std::cout, " File map RAW / LZ4HC blocks ....................... {:8d} / {}\n", (unsigned long long)summaryData.fileMapRaw, (unsigned long long)summaryData.fileMapHc);
+    }
+    if (options.entropyThreshold > 0)
+    {
+        std::print(std::cout, " Skipped by entropy ................................ {:8d}\n", (unsigned long long)summaryData.entropySkipped);
+        std::print(std::cout, " Skipped and checked / compressible ................ {:8d} / {}\n", (unsigned long long)summaryData.entropyChecked, (unsigned long long)summaryData.entropyWrong);
+        std::print(std::cout, " Bytes lost in the checked blocks .................. {:8d}\n", (unsigned long long)summaryData.entropyWrongLost);
+        std::print(std::cout, " Entropy prediction accuracy ....................... {:8.2f}%\n", summaryData.entropyChecked ? ((summaryData.entropyChecked - summaryData.entropyWrong) * 100.0) / summaryData.entropyChecked : 100.0);
+        std::print(std::cout, " RAW blocks not skipped ............................ {:8d}\n", (unsigned long long)summaryData.entropyMissed);
+    }
     std::print(std::cout, "\n\n");
 }
\ No newline at end of file